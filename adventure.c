@@ -40,7 +40,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
+#include <sys/prctl.h>
 #include <time.h>
 
 #include "assert.h"
@@ -64,6 +64,7 @@ static int sanity_check (void);
 
 /* a few constants */
 #define TICK_USEC      50000 /* tick length in microseconds          */
+#define TICK_SPIN_USEC 200   /* time spent polling before each tick  */
 #define STATUS_MSG_LEN 40    /* maximum length of status message     */
 #define MOTION_SPEED   2     /* pixels moved per command             */
 
@@ -143,7 +144,9 @@ static void move_photo_right (void);
 static void move_photo_up (void);
 static void redraw_room (void);
 static void* status_thread (void* ignore);
-static int time_is_after (struct timeval* t1, struct timeval* t2);
+static int time_is_after (struct timespec* t1, struct timespec* t2);
+static void advance_tick (struct timespec* t);
+static void report_tick_stats (void);
 
 
 /* file-scope variables */
@@ -164,11 +167,16 @@ volatile cmd_t button_pressed = CMD_NONE;
  * acquired before reading or writing the message.  Further, if the message
  * is changed, the helper thread must be notified by signaling it with the 
  * condition variable msg_cv (while holding the msg_lock).
+ *
+ * The status_gen counts changes to the status bar other than typing (to 
+ * the status message and the room), so that the main loop only shows the
+ * status bar when it changes.  It is also protected by msg_lock.
  */
 static pthread_t status_thread_id;
 static pthread_mutex_t msg_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t  msg_cv = PTHREAD_COND_INITIALIZER;
 static char status_msg[STATUS_MSG_LEN + 1] = {'\0'};
+static uint32_t status_gen = 1;
 
 // intializing the tux lock and disipline line for tux synchronization
 static pthread_t tux_thread_id;
@@ -177,6 +185,19 @@ static pthread_cond_t Tux_disipline = PTHREAD_COND_INITIALIZER;
 
 static int32_t enter_room = 0;
 
+/* 
+ * lateness of the main loop in waking up for each tick (printed to stderr
+ * at the end of the game if MP2_STATS is set in the environment)
+ */
+static struct {
+    unsigned long ticks;    /* ticks waited for                   */
+    unsigned long overran;  /* ticks reached only after they came  */
+    unsigned long missed;   /* ticks skipped because loop was late */
+    double        late_sum; /* total lateness in microseconds     */
+    double        late_max; /* worst lateness in microseconds     */
+    double        over_max; /* worst overrun in microseconds      */
+} tick_stats;
+
 /* 
  * cancel_status_thread
  *   DESCRIPTION: Terminates the status message helper thread.  Used as
@@ -256,21 +277,32 @@ game_loop ()
      * Variables used to carry information between event loop ticks; see
      * initialization below for explanations of purpose.
      */
-    struct timeval start_time, tick_time;
+    struct timespec start_time, tick_time;
 
-    struct timeval cur_time; /* current time (during tick)      */
+    struct timespec cur_time; /* current time (during tick)     */
+    struct timespec wake_time; /* end of sleep before tick      */
+    double late;             /* lateness of wake-up (us)        */
+    int overran;             /* tick passed before waiting?     */
+    int err;                 /* error number from sleeping      */
     cmd_t cmd;               /* command issued by input control */
     //int32_t enter_room;      /* player has changed rooms        */
+    char msg[STATUS_MSG_LEN + 1]; /* status message shown          */
+    uint32_t gen;            /* status_gen during tick          */
+    uint32_t shown_gen = 0;  /* status_gen of status bar shown  */
+    uint32_t shown_typed = 0; /* typed command generation shown */
 
     /* Record the starting time--assume success. */
-    (void)gettimeofday (&start_time, NULL);
+    (void)clock_gettime (CLOCK_MONOTONIC, &start_time);
 
     /* Calculate the time at which the first event loop tick should occur. */
     tick_time = start_time;
-    if ((tick_time.tv_usec += TICK_USEC) > 1000000) {
-	tick_time.tv_sec++;
-	tick_time.tv_usec -= 1000000;
-    }
+    advance_tick (&tick_time);
+
+    /* 
+     * Ask the kernel not to delay our wake-ups to batch them with other
+     * timers (the default allows 50 microseconds).
+     */
+    (void)prctl (PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
 
     /* The player has just entered the first room. */
     enter_room = 1;
@@ -290,10 +322,18 @@ game_loop ()
 
 	    /* Discard any partially-typed command. */
 	    reset_typed_command ();
+
+	    /* Show the new room's name in the status bar. */
+	    (void)pthread_mutex_lock (&msg_lock);
+	    status_gen++;
+	    (void)pthread_mutex_unlock (&msg_lock);
 	    
 	    /* Adjust colors and photo drawing for the current room photo. */
 	    prep_room (game_info.where);
 
+	    /* Start reading the photos of the rooms that may come next. */
+	    world_prefetch_neighbors (game_info.where);
+
 	    /* Draw the room (calls show. */
 	    redraw_room ();
 
@@ -303,39 +343,84 @@ game_loop ()
 
 	show_screen ();
 	
-	//lock the status messgae from being changed in order to be printed on the status bar  
+	/* 
+	 * Show the status bar only if the status message, the room, or the
+	 * typed command has changed since it was last shown.  The message
+	 * is copied so that msg_lock is not held while drawing.
+	 */
 	(void)pthread_mutex_lock (&msg_lock);
-	// call function to set up the status bar and print out contents given
-	show_status_bar (room_name(game_info.where),get_typed_command (),status_msg);
-	// unlock the status message so it can be changed  
+	gen = status_gen;
+	if (gen != shown_gen)
+	    (void)strcpy (msg, status_msg);
 	(void)pthread_mutex_unlock (&msg_lock);
+	if (gen != shown_gen || get_typed_generation () != shown_typed) {
+	    shown_gen = gen;
+	    shown_typed = get_typed_generation ();
+	    show_status_bar (room_name (game_info.where), get_typed_command (),
+			     msg);
+	}
 
 	/*
 	 * Wait for tick.  The tick defines the basic timing of our
 	 * event loop, and is the minimum amount of time between events.
+	 * We sleep until TICK_SPIN_USEC before the tick (by absolute time,
+	 * so that ticks do not drift), restarting the sleep if a signal 
+	 * interrupts it.  Waking up from sleep can take some time, so we
+	 * then poll the clock for the rest of the wait.  If the work done 
+	 * during the last tick has already taken us past this one, we do 
+	 * not wait at all.
 	 */
+	wake_time = tick_time;
+	if ((wake_time.tv_nsec -= TICK_SPIN_USEC * 1000L) < 0) {
+	    wake_time.tv_sec--;
+	    wake_time.tv_nsec += 1000000000L;
+	}
+	err = 0;
+	overran = (clock_gettime (CLOCK_MONOTONIC, &cur_time) == 0 &&
+		   time_is_after (&cur_time, &tick_time));
+	while (!overran && (err = clock_nanosleep (CLOCK_MONOTONIC, 
+				TIMER_ABSTIME, &wake_time, NULL)) == EINTR);
 	do {
-	    if (gettimeofday (&cur_time, NULL) != 0) {
+	    if (err != 0 || clock_gettime (CLOCK_MONOTONIC, &cur_time) != 0) {
 		/* Panic!  (should never happen) */
 		clear_mode_X ();
 		shutdown_input ();
-		perror ("gettimeofday");
+		if (err != 0)
+		    errno = err;
+		perror ("waiting for tick");
 		exit (3);
 	    }
 	} while (!time_is_after (&cur_time, &tick_time));
 	// display_time_on_tux (tick_time.tv_sec);
+
+	/* 
+	 * Record how late we woke up, or how far past the tick the last
+	 * tick's work ran.
+	 */
+	late = (cur_time.tv_sec - tick_time.tv_sec) * 1e6 + 
+	       (cur_time.tv_nsec - tick_time.tv_nsec) / 1e3;
+	if (overran) {
+	    tick_stats.overran++;
+	    if (late > tick_stats.over_max)
+		tick_stats.over_max = late;
+	} else {
+	    tick_stats.ticks++;
+	    tick_stats.late_sum += late;
+	    if (late > tick_stats.late_max)
+		tick_stats.late_max = late;
+	}
+
 	/*
 	 * Advance the tick time.  If we missed one or more ticks completely, 
 	 * i.e., if the current time is already after the time for the next 
 	 * tick, just skip the extra ticks and advance the clock to the one
 	 * that we haven't missed.
 	 */
-	do {
-	    if ((tick_time.tv_usec += TICK_USEC) > 1000000) {
-		tick_time.tv_sec++;
-		tick_time.tv_usec -= 1000000;
-	    }
-	} while (time_is_after (&cur_time, &tick_time));
+	advance_tick (&tick_time);
+	while (time_is_after (&cur_time, &tick_time)) {
+	    advance_tick (&tick_time);
+	    tick_stats.missed++;
+	}
 	// call the display time on the TUX
 		display_time_on_tux (cur_time.tv_sec-start_time.tv_sec);
 
@@ -567,7 +652,6 @@ static void
 move_photo_down ()
 {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over rows to redraw.         */
 
     /* Calculate the number of pixels by which to move. */
     delta = (game_info.y_speed > game_info.map_y ?
@@ -578,9 +662,7 @@ move_photo_down ()
     set_view_window (game_info.map_x, game_info.map_y);
 
     /* Draw the newly exposed lines. */
-    for (idx = 0; delta > idx; idx++) {
-	(void)draw_horiz_line (idx);
-    }
+    (void)draw_horiz_block (0, delta);
 }
 
 
@@ -598,7 +680,6 @@ static void
 move_photo_left ()
 {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over columns to redraw.      */
 
     /* Calculate the number of pixels by which to move. */
     delta = room_photo_width (game_info.where) - SCROLL_X_DIM -
@@ -610,9 +691,7 @@ move_photo_left ()
     set_view_window (game_info.map_x, game_info.map_y);
 
     /* Draw the newly exposed lines. */
-    for (idx = 1; delta >= idx; idx++) {
-	(void)draw_vert_line (SCROLL_X_DIM - idx);
-    }
+    (void)draw_vert_strip (SCROLL_X_DIM - delta, delta);
 }
 
 
@@ -630,7 +709,6 @@ static void
 move_photo_right ()
 {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over columns to redraw.      */
 
     /* Calculate the number of pixels by which to move. */
     delta = (game_info.x_speed > game_info.map_x ?
@@ -641,9 +719,7 @@ move_photo_right ()
     set_view_window (game_info.map_x, game_info.map_y);
 
     /* Draw the newly exposed lines. */
-    for (idx = 0; delta > idx; idx++) {
-	(void)draw_vert_line (idx);
-    }
+    (void)draw_vert_strip (0, delta);
 }
 
 
@@ -661,7 +737,6 @@ static void
 move_photo_up ()
 {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over rows to redraw.         */
 
     /* Calculate the number of pixels by which to move. */
     delta = room_photo_height (game_info.where) - SCROLL_Y_DIM - 
@@ -673,9 +748,7 @@ move_photo_up ()
     set_view_window (game_info.map_x, game_info.map_y);
 
     /* Draw the newly exposed lines. */
-    for (idx = 1; delta >= idx; idx++) {
-	(void)draw_horiz_line (SCROLL_Y_DIM - idx);
-    }
+    (void)draw_horiz_block (SCROLL_Y_DIM - delta, delta);
 }
 
 
@@ -690,12 +763,8 @@ move_photo_up ()
 static void
 redraw_room ()
 {
-    int32_t i; /* index over rows */
-
     /* Draw all lines in the scroll region. */
-    for (i = 0; i < SCROLL_Y_DIM; i++) {
-	(void)draw_horiz_line (i);
-    }
+    (void)draw_horiz_block (0, SCROLL_Y_DIM);
 }
 
 
@@ -759,6 +828,7 @@ status_thread (void* ignore)
 	 * pthread_cond_timedwait reacquires the lock before returning).
 	 */
 	status_msg[0] = '\0';
+	status_gen++;
 	(void)pthread_mutex_unlock (&msg_lock);
     }
 
@@ -778,16 +848,59 @@ status_thread (void* ignore)
  *   SIDE EFFECTS: none
  */
 static int
-time_is_after (struct timeval* t1, struct timeval* t2)
+time_is_after (struct timespec* t1, struct timespec* t2)
 {
     if (t1->tv_sec == t2->tv_sec)
-        return (t1->tv_usec >= t2->tv_usec);
+        return (t1->tv_nsec >= t2->tv_nsec);
     if (t1->tv_sec > t2->tv_sec)
         return 1;
     return 0;
 }
 
 
+/* 
+ * advance_tick
+ *   DESCRIPTION: Move a time forward by one event loop tick.
+ *   INPUTS: t -- the time
+ *   OUTPUTS: t -- the time one tick later
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+advance_tick (struct timespec* t)
+{
+    if ((t->tv_nsec += TICK_USEC * 1000L) >= 1000000000L) {
+	t->tv_sec++;
+	t->tv_nsec -= 1000000000L;
+    }
+}
+
+
+/* 
+ * report_tick_stats
+ *   DESCRIPTION: Print how late the main loop woke up for the ticks that
+ *                it waited for, how many ticks came before the loop's 
+ *                work for the last tick was done (and by how much), and
+ *                how many ticks it missed, if MP2_STATS is set in the
+ *                environment.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: prints to stderr
+ */
+static void
+report_tick_stats (void)
+{
+    if (NULL == getenv ("MP2_STATS"))
+	return;
+    fprintf (stderr, "ticks: %lu waited, %lu overran (%.1f us worst), "
+	     "%lu missed; wake-up lateness %.1f us average, %.1f us worst\n",
+	     tick_stats.ticks, tick_stats.overran, tick_stats.over_max,
+	     tick_stats.missed, tick_stats.late_sum / 
+	     (tick_stats.ticks ? tick_stats.ticks : 1), tick_stats.late_max);
+}
+
+
 /* 
  * show_status (interface function; declared in world.h)
  *   DESCRIPTION: Show a specific status message of up to STATUS_MSG_LEN
@@ -795,7 +908,8 @@ time_is_after (struct timeval* t1, struct timeval* t2)
  *   INPUTS: s -- the string used for the status message
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Overwrites any previous message.
+ *   SIDE EFFECTS: Overwrites any previous message; marks the status bar
+ *                 as changed.
  */
 void
 show_status (const char* s)
@@ -806,6 +920,7 @@ show_status (const char* s)
     /* Copy the new message under the protectio n of msg_lock. */
     strncpy (status_msg, s, STATUS_MSG_LEN);
     status_msg[STATUS_MSG_LEN] = '\0';
+    status_gen++;
 
     /* 
      * Wake up the status message helper thread.  Note that we still hold
@@ -861,7 +976,8 @@ main ()
     push_cleanup (cancel_status_thread, NULL); {
 
 	/* Start mode X. */
-	if (0 != set_mode_X (fill_horiz_buffer, fill_vert_buffer)) {
+	if (0 != set_mode_X (fill_horiz_buffer, fill_vert_buffer, 
+			     fill_vert_strip, fill_horiz_block)) {
 	    PANIC ("cannot initialize mode X");
 	}
 	push_cleanup ((cleanup_fn_t)clear_mode_X, NULL); {
@@ -887,6 +1003,7 @@ main ()
 	case GAME_WON: printf ("You win the game!  CONGRATULATIONS!\n"); break;
 	case GAME_QUIT: printf ("Quitter!\n"); break;
     }
+    report_tick_stats ();
 
     /* Return success. */
     return 0;
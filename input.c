@@ -140,6 +140,7 @@ init_input ()
 }
 
 static char typing[MAX_TYPED_LEN + 1] = {'\0'};
+static uint32_t typing_gen = 0; /* number of changes to typing */
 
 const char*
 get_typed_command ()
@@ -147,10 +148,17 @@ get_typed_command ()
     return typing;
 }
 
+uint32_t
+get_typed_generation ()
+{
+    return typing_gen;
+}
+
 void
 reset_typed_command ()
 {
     typing[0] = '\0';
+    typing_gen++;
 }
 
 static int32_t
@@ -168,10 +176,12 @@ typed_a_char (char c)
     if (8 == c || 127 == c) {
         if (0 < len) {
 	    typing[len - 1] = '\0';
+	    typing_gen++;
 	}
     } else if (MAX_TYPED_LEN > len) {
 	typing[len] = c;
 	typing[len + 1] = '\0';
+	typing_gen++;
     }
 }
 
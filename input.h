@@ -38,6 +38,8 @@
 #ifndef INPUT_H
 #define INPUT_H
 
+#include <stdint.h>
+
 /* possible commands from input device, whether keyboard or game controller */
 typedef enum {
     CMD_NONE, CMD_RIGHT, CMD_LEFT, CMD_UP, CMD_DOWN,
@@ -60,6 +62,12 @@ extern cmd_t tux_command();
 /* Get currently typed command string. */
 extern const char* get_typed_command ();
 
+/* 
+ * Get a count of the changes to the typed command, which changes whenever
+ * the command does.
+ */
+extern uint32_t get_typed_generation ();
+
 /* Reset typed command. */
 extern void reset_typed_command ();
 
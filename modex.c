@@ -41,12 +41,18 @@
  */
 
 #include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <sys/io.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#include <sys/io.h>
+#endif
+
 #include "modex.h"
 #include "text.h"
 
@@ -68,11 +74,18 @@
  * means an extra 64kB memory copy with every scroll pixel.  Finally,
  * BUILD_BASE_INIT places initial (or transferred) logical view in the
  * middle of the available buffer area.
+ *
+ * These sizes are only the default layout of the build buffer.  When a
+ * room's photo is small enough that all four planes of the whole photo
+ * fit in BUILD_BUF_LIMIT bytes, size_build_buffer lays the buffer out 
+ * with rows as wide as the photo and planes as tall as the photo, so 
+ * that the view never has to move within the buffer.
  */
 #define SCROLL_SIZE     (SCROLL_X_WIDTH * SCROLL_Y_DIM)
 #define SCREEN_SIZE	(SCROLL_SIZE * 4 + 1)
 #define BUILD_BUF_SIZE  (SCREEN_SIZE + 20000) 
 #define BUILD_BASE_INIT ((BUILD_BUF_SIZE - SCREEN_SIZE) / 2)
+#define BUILD_BUF_LIMIT 1048576
 
 /* Mode X and general VGA parameters */
 #define VID_MEM_SIZE       131072
@@ -82,6 +95,30 @@
 #define NUM_GRAPHICS_REGS       9
 #define NUM_ATTR_REGS          22
 
+/* 
+ * Captured frames hold the whole displayed screen: the scrolling image
+ * above the status bar.  FRAME_CAPTURE_PREFIX starts the names of the
+ * files written when SIGUSR1 is received (see set_frame_capture).
+ */
+#define STATUS_Y_DIM         (STATUS_BAR_SIZE * 4 / IMAGE_X_DIM)
+#define FRAME_Y_DIM          (IMAGE_Y_DIM + STATUS_Y_DIM)
+#define FRAME_CAPTURE_PREFIX "frame-"
+
+/* 
+ * Lines are split into planes in groups of four pixels (one per plane).
+ * A line starting at any x covers at most LINE_GROUPS groups, and each
+ * plane's part of a line is held in a strip of PLANE_STRIP bytes (with
+ * room for vector stores past the end).
+ */
+#define LINE_GROUPS (SCROLL_X_WIDTH + 1)
+#define PLANE_STRIP 96
+
+/* 
+ * A block of lines is split into planes all at once, covering at most
+ * BLOCK_GROUPS groups.
+ */
+#define BLOCK_GROUPS (MAX_BLOCK_HEIGHT * SCROLL_X_WIDTH + 1)
+
 /* VGA register settings for mode X */
 static unsigned short mode_X_seq[NUM_SEQUENCER_REGS] = {
     0x0100, 0x2101, 0x0F02, 0x0003, 0x0604
@@ -129,8 +166,70 @@ static unsigned short text_graphics[NUM_GRAPHICS_REGS] = {
 };
 
 
+/* 
+ * A display backend carries out every access to the video adapter:  
+ * reads and writes of the VGA ports, and writes to video memory (at an 
+ * offset from 0xA0000, to the planes enabled by the sequencer's map 
+ * mask, as the adapter would).  The VGA backend uses the real adapter.
+ * The headless backend emulates the registers, planes, and palette 
+ * used by this file in ordinary memory, so that the drawing code can 
+ * run (and be measured) on machines without a VGA.  The backend is 
+ * chosen by set_mode_X (see set_display_backend).
+ */
+typedef struct display_ops_t display_ops_t;
+struct display_ops_t {
+    int (*open) ();                      /* map memory and get ports  */
+    void (*close) ();                    /* release memory            */
+    void (*out_b) (unsigned short port, unsigned char val);
+    void (*out_w) (unsigned short port, unsigned short val);
+    unsigned char (*in_b) (unsigned short port);
+    void (*write_mem) (unsigned int addr, const void* src, unsigned int n);
+    void (*fill_mem) (unsigned int addr, unsigned char val, unsigned int n);
+};
+
+
 /* local functions--see function headers for details */
-static int open_memory_and_ports ();
+static const display_ops_t* pick_display ();
+#if defined(__i386__) || defined(__x86_64__)
+static int vga_open ();
+static void vga_close ();
+static void vga_out_b (unsigned short port, unsigned char val);
+static void vga_out_w (unsigned short port, unsigned short val);
+static unsigned char vga_in_b (unsigned short port);
+static void vga_write_mem (unsigned int addr, const void* src, 
+			   unsigned int n);
+static void vga_fill_mem (unsigned int addr, unsigned char val, 
+			  unsigned int n);
+#endif
+static int emu_open ();
+static void emu_close ();
+static void emu_out_b (unsigned short port, unsigned char val);
+static void emu_out_w (unsigned short port, unsigned short val);
+static unsigned char emu_in_b (unsigned short port);
+static void emu_write_mem (unsigned int addr, const void* src, 
+			   unsigned int n);
+static void emu_fill_mem (unsigned int addr, unsigned char val, 
+			  unsigned int n);
+static void capture_frame (int new_frame);
+static int alloc_build (int size);
+static void default_layout ();
+#if !defined(TEXT_RESTORE_PROGRAM)
+static void select_split_planes (const unsigned char* src, int groups,
+				 unsigned char* dst, int stride);
+static void split_planes_c (const unsigned char* src, int groups,
+			    unsigned char* dst, int stride);
+#if defined(__i386__) || defined(__x86_64__)
+static void split_planes_sse2 (const unsigned char* src, int groups,
+			       unsigned char* dst, int stride);
+static void split_planes_avx2 (const unsigned char* src, int groups,
+			       unsigned char* dst, int stride);
+#endif
+#endif
+static void request_dump (int sig);
+static void rep_outsw (unsigned short port, const unsigned short* src,
+		       int count);
+static void rep_outsb (unsigned short port, const unsigned char* src,
+		       int count);
 static void VGA_blank (int blank_bit);
 static void set_seq_regs_and_reset (unsigned short table[NUM_SEQUENCER_REGS],
 				    unsigned char val);
@@ -165,7 +264,8 @@ static void copy_image_status (unsigned char* img, unsigned short scr_addr);
  * displaying a one-pixel left shift.
  *
  * The memory fence (included when NDEBUG is not defined) allocates
- * the build buffer with extra space on each side.  The extra space
+ * the build buffer with extra space on each side (just outside of the
+ * part in use when the buffer is larger than its current layout needs).  The extra space
  * is filled with magic numbers (something unlikely to be written in
  * error), and the fence areas are checked for those magic values at
  * the end of the program to detect array access bugs (writes past
@@ -177,15 +277,79 @@ static void copy_image_status (unsigned char* img, unsigned short scr_addr);
 #define MEM_FENCE_WIDTH 0
 #endif
 #define MEM_FENCE_MAGIC 0xF3
-static unsigned char build[BUILD_BUF_SIZE + 2 * MEM_FENCE_WIDTH];
+static unsigned char* build = NULL; /* buffer, including fences     */
+static int build_alloc = 0;         /* bytes allocated (w/o fences) */
+static int build_size;              /* bytes in use for images      */
+static int build_pitch;             /* bytes between rows in plane  */
+static int plane_size;              /* bytes between planes         */
+static int build_base;              /* img3_off of view at (0,0)    */
 static int img3_off;		    /* offset of upper left pixel   */
 static unsigned char* img3;	    /* pointer to upper left pixel  */
 static int show_x, show_y;          /* logical view coordinates     */
+static display_stats_t stats;       /* work done since set_mode_X   */
+static int screen_dirty = 1;        /* view changed since shown?    */
+static unsigned char dac_shadow[256][3]; /* colors written to palette */
+static int dac_valid = 0;           /* dac_shadow holds 64 and up?  */
+static int status_shown = 0;        /* status bar in video memory?  */
 
 /* displayed video memory variables */
 static unsigned char* mem_image;    /* pointer to start of video memory */
 static unsigned short target_img;   /* offset of displayed screen image */
 
+/* display backends */
+#if defined(__i386__) || defined(__x86_64__)
+static const display_ops_t vga_display = {
+    vga_open, vga_close, vga_out_b, vga_out_w, vga_in_b, vga_write_mem,
+    vga_fill_mem
+};
+#endif
+static const display_ops_t emu_display = {
+    emu_open, emu_close, emu_out_b, emu_out_w, emu_in_b, emu_write_mem,
+    emu_fill_mem
+};
+static display_backend_t backend = DISPLAY_DEFAULT; /* backend requested */
+static const display_ops_t* display = NULL;         /* backend in use    */
+
+/* 
+ * state of the emulated VGA used by the headless backend; each register
+ * group is written by placing an index in one port and data in the next
+ * (the attribute controller alternates index and data on one port)
+ */
+#define EMU_REG_GROUP 32	/* registers in each group (index mask + 1) */
+static struct {
+    unsigned char plane[4][VID_MEM_SIZE]; /* video memory, by plane     */
+    unsigned char seq[EMU_REG_GROUP];     /* sequencer (0x3C4/0x3C5)    */
+    unsigned char crtc[EMU_REG_GROUP];    /* CRTC (0x3D4/0x3D5)         */
+    unsigned char gfx[EMU_REG_GROUP];     /* graphics (0x3CE/0x3CF)     */
+    unsigned char attr[EMU_REG_GROUP];    /* attribute (0x3C0)          */
+    unsigned char seq_idx;                /* selected sequencer reg.    */
+    unsigned char crtc_idx;               /* selected CRTC register     */
+    unsigned char gfx_idx;                /* selected graphics register */
+    unsigned char attr_idx;               /* selected attribute reg.    */
+    unsigned char attr_data;              /* next 0x3C0 write is data?  */
+    unsigned char misc;                   /* misc. output (0x3C2)       */
+    unsigned char dac[256][3];            /* palette, 6-bit RGB         */
+    unsigned char dac_idx;                /* color written next         */
+    unsigned char dac_rgb;                /* component written next     */
+} emu;
+
+/* 
+ * Frame capture (headless backend only).  Each frame records the screen
+ * as the emulated VGA would display it, as palette indices, along with 
+ * the palette.  Frames are kept in a ring of n_frames entries; the most
+ * recent is frames[(frame_seq - 1) % n_frames].
+ */
+typedef struct frame_t frame_t;
+struct frame_t {
+    unsigned int  seq;                            /* frame number (from 1) */
+    unsigned char pix[FRAME_Y_DIM][IMAGE_X_DIM];  /* palette indices       */
+    unsigned char pal[256][3];                    /* 6-bit RGB palette     */
+};
+static frame_t* frames = NULL;     /* ring of captured frames          */
+static int n_frames = 0;           /* frames in ring (0 for no capture) */
+static unsigned int frame_seq = 0; /* number of frames captured         */
+static volatile sig_atomic_t dump_wanted = 0; /* SIGUSR1 received?     */
+
 
 /* 
  * functions provided by the caller to set_mode_X() and used to obtain  
@@ -194,6 +358,20 @@ static unsigned short target_img;   /* offset of displayed screen image */
  */
 static void (*horiz_line_fn) (int, int, unsigned char[SCROLL_X_DIM]);
 static void (*vert_line_fn) (int, int, unsigned char[SCROLL_Y_DIM]);
+static void (*strip_fn) (int, int, int, 
+			 unsigned char[MAX_STRIP_WIDTH][SCROLL_Y_DIM]);
+static void (*block_fn) (int, int, int, 
+			 unsigned char[MAX_BLOCK_HEIGHT][SCROLL_X_DIM]);
+
+#if !defined(TEXT_RESTORE_PROGRAM)
+/* 
+ * function used by draw_horiz_line and draw_horiz_block to split pixels 
+ * into planes; the first call picks the fastest version supported by the
+ * processor
+ */
+static void (*split_planes) (const unsigned char*, int, unsigned char*, 
+			     int) = select_split_planes;
+#endif
 	
 
 /* 
@@ -201,66 +379,46 @@ static void (*vert_line_fn) (int, int, unsigned char[SCROLL_Y_DIM]);
  * to video memory in mode X; bits 8-11 in the mask_hi_bits enable writes
  * to planes 0-3, respectively
  */
-#define SET_WRITE_MASK(mask_hi_bits)                                    \
-do {                                                                    \
-    asm volatile ("                                                     \
-	movw $0x03C4,%%dx    	/* set write mask                    */;\
-	movb $0x02,%b0                                                 ;\
-	outw %w0,(%%dx)                                                 \
-    " : : "a" ((mask_hi_bits)) : "edx", "memory");                      \
-} while (0)
+#define SET_WRITE_MASK(mask_hi_bits) OUTW (0x03C4, (mask_hi_bits) | 0x02)
 
 /* macro used to write a byte to a port */
-#define OUTB(port,val)                                                  \
-do {                                                                    \
-    asm volatile ("                                                     \
-        outb %b1,(%w0)                                                  \
-    " : /* no outputs */                                                \
-      : "d" ((port)), "a" ((val))                                       \
-      : "memory", "cc");                                                \
-} while (0)
+#define OUTB(port,val) (*display->out_b) ((port), (val))
 
 /* macro used to write two bytes to two consecutive ports */
-#define OUTW(port,val)                                                  \
-do {                                                                    \
-    asm volatile ("                                                     \
-        outw %w1,(%w0)                                                  \
-    " : /* no outputs */                                                \
-      : "d" ((port)), "a" ((val))                                       \
-      : "memory", "cc");                                                \
-} while (0)
+#define OUTW(port,val) (*display->out_w) ((port), (val))
+
+/* macro used to read a byte from a port */
+#define INB(port) (*display->in_b) ((port))
 
 /* 
  * macro used to write an array of two-byte values to two consecutive ports 
  */
 #define REP_OUTSW(port,source,count)                                    \
-do {                                                                    \
-    asm volatile ("                                                     \
-     1: movw 0(%1),%%ax                                                ;\
-	outw %%ax,(%w2)                                                ;\
-	addl $2,%1                                                     ;\
-	decl %0                                                        ;\
-	jne 1b                                                          \
-    " : /* no outputs */                                                \
-      : "c" ((count)), "S" ((source)), "d" ((port))                     \
-      : "eax", "memory", "cc");                                         \
-} while (0)
+	rep_outsw ((port), (const unsigned short*)(source), (count))
 
 /* 
  * macro used to write an array of one-byte values to two consecutive ports 
  */
 #define REP_OUTSB(port,source,count)                                    \
-do {                                                                    \
-    asm volatile ("                                                     \
-     1: movb 0(%1),%%al                                                ;\
-	outb %%al,(%w2)                                                ;\
-	incl %1                                                        ;\
-	decl %0                                                        ;\
-	jne 1b                                                          \
-    " : /* no outputs */                                                \
-      : "c" ((count)), "S" ((source)), "d" ((port))                     \
-      : "eax", "memory", "cc");                                         \
-} while (0)
+	rep_outsb ((port), (const unsigned char*)(source), (count))
+
+
+/*
+ * set_display_backend
+ *   DESCRIPTION: Choose the display used by the next call to set_mode_X.
+ *                By default, the headless backend is used if the 
+ *                MP2_HEADLESS environment variable is set to anything
+ *                but "0", and the VGA is used otherwise.
+ *   INPUTS: b -- the backend
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+void
+set_display_backend (display_backend_t b)
+{
+    backend = b;
+}
 
 
 /*
@@ -274,44 +432,70 @@ do {                                                                    \
  *   			     draw_vert_line) to obtain a graphical 
  *   			     image of a particular logical line for 
  *   			     drawing to the build buffer
+ *           strip_fill_fn -- this function is used as a callback (by
+ *   			      draw_vert_strip) to obtain a graphical 
+ *   			      image of up to MAX_STRIP_WIDTH adjacent
+ *   			      logical vertical lines, one line per row,
+ *   			      for drawing to the build buffer
+ *           block_fill_fn -- this function is used as a callback (by
+ *   			      draw_horiz_block) to obtain a graphical 
+ *   			      image of up to MAX_BLOCK_HEIGHT adjacent
+ *   			      logical horizontal lines for drawing to the
+ *   			      build buffer
  *   OUTPUTS: none
  *   RETURN VALUE: 0 on success, -1 on failure
- *   SIDE EFFECTS: initializes the logical view window; maps video memory
- *                 and obtains permission for VGA ports; clears video memory
+ *   SIDE EFFECTS: initializes the logical view window; chooses the display
+ *                 backend; maps video memory and obtains permission for 
+ *                 VGA ports; clears video memory
  */   
 int
 set_mode_X (void (*horiz_fill_fn) (int, int, unsigned char[SCROLL_X_DIM]),
-            void (*vert_fill_fn) (int, int, unsigned char[SCROLL_Y_DIM]))
+            void (*vert_fill_fn) (int, int, unsigned char[SCROLL_Y_DIM]),
+	    void (*strip_fill_fn) 
+		 (int, int, int, unsigned char[MAX_STRIP_WIDTH][SCROLL_Y_DIM]),
+	    void (*block_fill_fn) 
+		 (int, int, int, unsigned char[MAX_BLOCK_HEIGHT][SCROLL_X_DIM]))
 {
-    int i; /* loop index for filling memory fence with magic numbers */
-
     /* 
      * Record callback functions for obtaining horizontal and vertical 
      * line images.
      */
-    if (horiz_fill_fn == NULL || vert_fill_fn == NULL)
+    if (horiz_fill_fn == NULL || vert_fill_fn == NULL || 
+	strip_fill_fn == NULL || block_fill_fn == NULL)
         return -1;
     horiz_line_fn = horiz_fill_fn;
     vert_line_fn = vert_fill_fn;
+    strip_fn = strip_fill_fn;
+    block_fn = block_fill_fn;
 
-    /* Initialize the logical view window to position (0,0). */
+    /* 
+     * Allocate the build buffer with its default layout, and initialize 
+     * the logical view window to position (0,0).
+     */
     show_x = show_y = 0;
-    img3_off = BUILD_BASE_INIT;
-    img3 = build + img3_off + MEM_FENCE_WIDTH;
-
-    /* Set up the memory fence on the build buffer. */
-    for (i = 0; i < MEM_FENCE_WIDTH; i++) {
-        build[i] = MEM_FENCE_MAGIC;
-        build[BUILD_BUF_SIZE + MEM_FENCE_WIDTH + i] = MEM_FENCE_MAGIC;
-    }
+    memset (&stats, 0, sizeof (stats));
+    screen_dirty = 1;
+    dac_valid = 0;
+    if (alloc_build (BUILD_BUF_SIZE) == -1)
+        return -1;
+    default_layout ();
 
     /* One display page goes at the start of video memory. */
     target_img = STATUS_BAR_SIZE; 
 
-    /* Map video memory and obtain permission for VGA port access. */
-    if (open_memory_and_ports () == -1)
+    /* 
+     * Choose the display, then map video memory and obtain permission 
+     * for VGA port access.
+     */
+    if ((display = pick_display ()) == NULL || (*display->open) () == -1)
         return -1;
 
+    /* Start recording frames if asked to by the environment. */
+    if (display == &emu_display && frames == NULL && 
+	getenv ("MP2_CAPTURE") != NULL &&
+	set_frame_capture (atoi (getenv ("MP2_CAPTURE"))) == -1)
+	puts ("not enough memory to record frames");
+
     /* 
      * The code below was produced by recording a call to set mode 0013h
      * with display memory clearing and a windowed frame buffer, then
@@ -356,7 +540,16 @@ clear_mode_X ()
     set_text_mode_3 (1);
 
     /* Unmap video memory. */
-    (void)munmap (mem_image, VID_MEM_SIZE);
+    (*display->close) ();
+
+    /* Report the work done by the display if asked to. */
+    if (getenv ("MP2_STATS") != NULL)
+	fprintf (stderr, "build buffer: %lu relocations (%llu bytes moved), "
+		 "%lu recenterings; frames: %lu presented, %lu skipped; "
+		 "palette: %llu port writes, %llu saved\n", 
+		 stats.relocations, stats.bytes_moved, stats.recenterings,
+		 stats.presented, stats.skipped, stats.palette_writes,
+		 stats.palette_saved);
 
     /* Check validity of build buffer memory fence.  Report breakage. */
     for (i = 0; i < MEM_FENCE_WIDTH; i++) {
@@ -366,11 +559,118 @@ clear_mode_X ()
 	}
     }
     for (i = 0; i < MEM_FENCE_WIDTH; i++) {
-        if (build[BUILD_BUF_SIZE + MEM_FENCE_WIDTH + i] != MEM_FENCE_MAGIC) {
+        if (build[build_size + MEM_FENCE_WIDTH + i] != MEM_FENCE_MAGIC) {
 	    puts ("upper build fence was broken");
 	    break;
 	}
     }
+
+    /* Release the build buffer. */
+    free (build);
+    build = NULL;
+    build_alloc = 0;
+}
+
+
+/*
+ * size_build_buffer
+ *   DESCRIPTION: Choose the layout of the build buffer for a room photo.
+ *                If all four planes of the whole photo fit in 
+ *                BUILD_BUF_LIMIT bytes, each row of a plane is made as
+ *                wide as the photo and each plane as tall, so that every 
+ *                view of the photo fits in the buffer at once and 
+ *                set_view_window never moves data.  Otherwise, the 
+ *                default layout is used.  The contents of the build 
+ *                buffer are lost, so the view must be redrawn.
+ *   INPUTS: width -- photo width in pixels
+ *           height -- photo height in pixels
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the buffer holds the whole photo, 0 if it uses
+ *                 the default layout
+ *   SIDE EFFECTS: may reallocate the build buffer
+ */   
+int
+size_build_buffer (int width, int height)
+{
+    int pitch; /* bytes per row of a plane   */
+    int rows;  /* rows in a plane            */
+
+    pitch = (width + 3) >> 2;
+    if (pitch < SCROLL_X_WIDTH)
+        pitch = SCROLL_X_WIDTH;
+    rows = (height < SCROLL_Y_DIM ? SCROLL_Y_DIM : height);
+    screen_dirty = 1;
+    if (width <= 0 || height <= 0 || 
+	(BUILD_BUF_LIMIT - 1) / 4 / pitch < rows ||
+	alloc_build (4 * pitch * rows + 1) == -1) {
+	default_layout ();
+	return 0;
+    }
+
+    /* Place pixel (0,0) of the photo at the start of the buffer. */
+    build_pitch = pitch;
+    plane_size = pitch * rows;
+    build_base = 0;
+    img3_off = 0;
+    img3 = build + MEM_FENCE_WIDTH;
+    return 1;
+}
+
+
+/*
+ * alloc_build
+ *   DESCRIPTION: Make sure that the build buffer has at least a given 
+ *                number of bytes, then put the memory fence around that
+ *                many bytes.
+ *   INPUTS: size -- bytes to be used for images
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if out of memory (the buffer is
+ *                 unchanged)
+ *   SIDE EFFECTS: may reallocate the build buffer
+ */   
+static int
+alloc_build (int size)
+{
+    unsigned char* grown; /* reallocated buffer               */
+    int i;                /* loop index over memory fences    */
+
+    if (build_alloc < size) {
+	if ((grown = realloc (build, size + 2 * MEM_FENCE_WIDTH)) == NULL)
+	    return -1;
+	build = grown;
+	build_alloc = size;
+    }
+    build_size = size;
+
+    /* Set up the memory fence on the build buffer. */
+    for (i = 0; i < MEM_FENCE_WIDTH; i++) {
+        build[i] = MEM_FENCE_MAGIC;
+        build[build_size + MEM_FENCE_WIDTH + i] = MEM_FENCE_MAGIC;
+    }
+    return 0;
+}
+
+
+/*
+ * default_layout
+ *   DESCRIPTION: Use the default layout of the build buffer (which must 
+ *                have at least BUILD_BUF_SIZE bytes), placing the current
+ *                logical view window in the middle.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the build buffer layout and the memory fence
+ */   
+static void
+default_layout ()
+{
+    (void)alloc_build (BUILD_BUF_SIZE);
+    screen_dirty = 1;
+    build_pitch = SCROLL_X_WIDTH;
+    plane_size = SCROLL_SIZE;
+    build_base = BUILD_BASE_INIT;
+    img3_off = build_base - (show_x >> 2) - show_y * build_pitch;
+    img3 = build + img3_off + MEM_FENCE_WIDTH;
 }
 
 
@@ -387,7 +687,8 @@ clear_mode_X ()
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: may shift position of logical view window within build 
- *                 buffer
+ *                 buffer; counts the moves in the display statistics;
+ *                 marks the screen as changed if the window moves
  */   
 void
 set_view_window (int scr_x, int scr_y)
@@ -398,7 +699,6 @@ set_view_window (int scr_x, int scr_y)
     int start_off;        /* offset of copy start relative to old build    */
      		          /*    buffer start position                      */
     int length;           /* amount of data to be copied                   */
-    int i;	          /* copy loop index                               */
     unsigned char* start_addr;  /* starting memory address of copy     */
     unsigned char* target_addr; /* destination memory address for copy */
 
@@ -409,15 +709,17 @@ set_view_window (int scr_x, int scr_y)
     /* Keep track of the new view window. */
     show_x = scr_x;
     show_y = scr_y;
+    if (scr_x != old_x || scr_y != old_y)
+	screen_dirty = 1;
 
     /*
      * If the new view window fits within the boundaries of the build 
      * buffer, we need move nothing around.
     */
-    if (img3_off + (scr_x >> 2) + scr_y * SCROLL_X_WIDTH >= 0 &&
-        img3_off + 3 * SCROLL_SIZE +
+    if (img3_off + (scr_x >> 2) + scr_y * build_pitch >= 0 &&
+        img3_off + 3 * plane_size +
 	    ((scr_x + SCROLL_X_DIM - 1) >> 2) + 
-	    (scr_y + SCROLL_Y_DIM - 1) * SCROLL_X_WIDTH < BUILD_BUF_SIZE)
+	    (scr_y + SCROLL_Y_DIM - 1) * build_pitch < build_size)
 	return;
 
     /*
@@ -427,8 +729,9 @@ set_view_window (int scr_x, int scr_y)
      */
     if (scr_x <= old_x - SCROLL_X_DIM || scr_x >= old_x + SCROLL_X_DIM ||
 	scr_y <= old_y - SCROLL_Y_DIM || scr_y >= old_y + SCROLL_Y_DIM) {
-	img3_off = BUILD_BASE_INIT - (scr_x >> 2) - scr_y * SCROLL_X_WIDTH;
+	img3_off = build_base - (scr_x >> 2) - scr_y * build_pitch;
 	img3 = build + img3_off + MEM_FENCE_WIDTH;
+	stats.recenterings++;
 	return;
     }
 
@@ -466,36 +769,55 @@ set_view_window (int scr_x, int scr_y)
      * length to be copied is basically the ending offset minus the starting
      * offset plus one (plus the three screens in between planes 3 and 0).
      */
-    start_off = (start_x >> 2) + start_y * SCROLL_X_WIDTH;
+    start_off = (start_x >> 2) + start_y * build_pitch;
     start_addr = img3 + start_off;
-    length = (end_x >> 2) + end_y * SCROLL_X_WIDTH + 1 - start_off + 
-	     3 * SCROLL_SIZE;
-    img3_off = BUILD_BASE_INIT - (show_x >> 2) - show_y * SCROLL_X_WIDTH;
+    length = (end_x >> 2) + end_y * build_pitch + 1 - start_off + 
+	     3 * plane_size;
+    img3_off = build_base - (show_x >> 2) - show_y * build_pitch;
     img3 = build + img3_off + MEM_FENCE_WIDTH;
     target_addr = img3 + start_off;
 
     /* 
      * Copy the relevant portion of the screen from the old location to the
      * new one.  The areas may overlap, so copy direction is important. 
-     * (You should be able to explain why!)
+     * (You should be able to explain why!)  memmove picks the direction
+     * for us.
      */
-    if (start_addr < target_addr)
-	for (i = length; i-- > 0; )
-	    target_addr[i] = start_addr[i];
-    else
-	for (i = 0; i < length; i++)
-	    target_addr[i] = start_addr[i];
+    memmove (target_addr, start_addr, length);
+    stats.relocations++;
+    stats.bytes_moved += length;
+}
+
+
+/*
+ * get_display_stats
+ *   DESCRIPTION: Get counts of the work done by the display since mode X
+ *                was last set.
+ *   INPUTS: none
+ *   OUTPUTS: s -- the counts
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+void
+get_display_stats (display_stats_t* s)
+{
+    *s = stats;
 }
 
 
 /*
  * show_screen
- *   DESCRIPTION: Show the logical view window on the video display.
+ *   DESCRIPTION: Show the logical view window on the video display.  If
+ *                neither the view window nor the build buffer has changed
+ *                since the last screen shown, the screen already on the
+ *                display is left there.
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: copies from the build buffer to video memory;
- *                 shifts the VGA display source to point to the new image
+ *                 shifts the VGA display source to point to the new image;
+ *                 counts the frames presented and skipped in the display
+ *                 statistics
  */   
 void
 show_screen ()
@@ -504,6 +826,18 @@ show_screen ()
     int p_off;            /* plane offset of first display plane */
     int i;		  /* loop index over video planes        */
 
+    /* 
+     * Nothing has changed, so skip the copy and the page flip.  A frame
+     * is still recorded, so that one is recorded for each call.
+     */
+    if (!screen_dirty) {
+	stats.skipped++;
+	capture_frame (1);
+	return;
+    }
+    screen_dirty = 0;
+    stats.presented++;
+
     /* 
      * Calculate offset of build buffer plane to be mapped into plane 0 
      * of display.
@@ -514,12 +848,12 @@ show_screen ()
     target_img ^= 0x4000;
 
     /* Calculate the source address. */
-    addr = img3 + (show_x >> 2) + show_y * SCROLL_X_WIDTH;
+    addr = img3 + (show_x >> 2) + show_y * build_pitch;
 
     /* Draw to each plane in the video memory. */
     for (i = 0; i < 4; i++) {
 	SET_WRITE_MASK (1 << (i + 8));
-	copy_image (addr + ((p_off - i + 4) & 3) * SCROLL_SIZE + (p_off < i), 
+	copy_image (addr + ((p_off - i + 4) & 3) * plane_size + (p_off < i), 
 	            target_img);
     }
 
@@ -529,10 +863,15 @@ show_screen ()
      */
     OUTW (0x03D4, (target_img & 0xFF00) | 0x0C);
     OUTW (0x03D4, ((target_img & 0x00FF) << 8) | 0x0D);
+
+    /* Record the new frame. */
+    capture_frame (1);
 }
 /*
  * show_status_bar
- *   DESCRIPTION: Show the status bar on the video display.
+ *   DESCRIPTION: Show the status bar on the video display.  If the status
+ *                bar image has not changed since it was last shown, 
+ *                nothing is written.
  *   INPUTS: s -- the string that tells the location name of the current image to be displayed on the left side
  *           input -- the string that is given by the user and is displayed on the right side of the screen
  *          status_image -- the string that tells the gamer if something is possible or not. 
@@ -544,27 +883,132 @@ show_screen ()
 void
 show_status_bar (const char* s, const char* input, const char *status_msg)
 {
+    /* 
+     * planar image of the status bar, kept between calls so that only 
+     * the parts that change are set up again
+     */
+    static unsigned char buffer[STATUS_BAR_SIZE * 4]; 
+    int i; /* loop index over video planes */
+
+    /* Set up the image; nothing more to do if it is already shown. */
+    if (set_text_to_buffer (s, input, status_msg, buffer) == 0 && 
+	status_shown)
+	return;
+    status_shown = 1;
 
-    /* Buffer of size of the status bar used to copy to the VGA memory*/
-    unsigned char buffer[STATUS_BAR_SIZE*4]; 
-    // set the status bar planar buffer from the strings given 
-    set_text_to_buffer(s,input, status_msg, buffer);
     /* Draw to each plane in the video memory. */
-    int i;
-    // loop traverses through the planes of the status bar 
     for (i = 0; i < 4; i++) {
         SET_WRITE_MASK (1 << (i + 8));
-        copy_image_status (buffer+(i*1440),0);  // copy each plane of the status bar into the VGA memory
+        copy_image_status (buffer + i * STATUS_BAR_SIZE, 0);
+    }
+
+    /* Update the last frame recorded. */
+    capture_frame (0);
+}
+
+
+/*
+ * set_frame_capture
+ *   DESCRIPTION: Start recording the most recent frames shown (up to a
+ *                given number), or stop recording.  Frames can only be
+ *                recorded with the headless backend.  Each call to 
+ *                show_screen records a new frame; show_status_bar 
+ *                updates the last one.  While recording, SIGUSR1 causes
+ *                the frames to be written (as by dump_frames, with 
+ *                prefix FRAME_CAPTURE_PREFIX) at the next show_screen.
+ *                By default, set_mode_X starts recording the number of
+ *                frames given by the MP2_CAPTURE environment variable,
+ *                if any.
+ *   INPUTS: n -- number of frames to keep, or 0 to stop
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if out of memory
+ *   SIDE EFFECTS: discards frames recorded; changes the action for 
+ *                 SIGUSR1
+ */   
+int
+set_frame_capture (int n)
+{
+    struct sigaction sa; /* signal behavior definition structure */
+
+    free (frames);
+    frames = NULL;
+    n_frames = 0;
+    frame_seq = 0;
+
+    memset (&sa, 0, sizeof (sa));
+    sa.sa_handler = SIG_DFL;
+    if (n > 0) {
+	if ((frames = malloc (n * sizeof (frames[0]))) == NULL)
+	    return -1;
+	n_frames = n;
+	sa.sa_handler = request_dump;
+    }
+    (void)sigaction (SIGUSR1, &sa, NULL);
+    return 0;
+}
+
+
+/*
+ * dump_frames
+ *   DESCRIPTION: Write the recorded frames, oldest first, as binary PPM
+ *                files named by the prefix followed by the frame number
+ *                (e.g., "frame-000123.ppm").
+ *   INPUTS: prefix -- start of file names (may include a directory)
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of frames written, or -1 on failure
+ *   SIDE EFFECTS: writes files; prints an error message to stdout on 
+ *                 failure
+ */   
+int
+dump_frames (const char* prefix)
+{
+    static unsigned char rgb[FRAME_Y_DIM][IMAGE_X_DIM][3]; /* file pixels */
+    unsigned char level[64];  /* 6-bit to 8-bit color component     */
+    char fname[FILENAME_MAX]; /* name of file                       */
+    const frame_t* f;         /* frame being written                */
+    unsigned int seq;         /* index over recorded frames         */
+    unsigned int first;       /* oldest frame kept                  */
+    FILE* out;                /* file being written                 */
+    int x, y;                 /* loop indices over pixels           */
+    int ok;                   /* file written?                      */
+
+    for (x = 0; x < 64; x++)
+	level[x] = (x << 2) | (x >> 4);
+    first = (frame_seq > (unsigned int)n_frames ? frame_seq - n_frames : 0);
+    for (seq = first; seq < frame_seq; seq++) {
+	f = &frames[seq % n_frames];
+	for (y = 0; y < FRAME_Y_DIM; y++) {
+	    for (x = 0; x < IMAGE_X_DIM; x++) {
+		rgb[y][x][0] = level[f->pal[f->pix[y][x]][0]];
+		rgb[y][x][1] = level[f->pal[f->pix[y][x]][1]];
+		rgb[y][x][2] = level[f->pal[f->pix[y][x]][2]];
+	    }
+	}
+	(void)snprintf (fname, sizeof (fname), "%s%06u.ppm", prefix, f->seq);
+	if ((out = fopen (fname, "wb")) == NULL) {
+	    perror (fname);
+	    return -1;
+	}
+	ok = (fprintf (out, "P6\n%d %d\n255\n", IMAGE_X_DIM, 
+		       FRAME_Y_DIM) > 0 &&
+	      fwrite (rgb, sizeof (rgb), 1, out) == 1);
+	if (fclose (out) != 0 || !ok) {
+	    perror (fname);
+	    return -1;
+	}
     }
+    return frame_seq - first;
 }
 
+
 /*
  * clear_screens
  *   DESCRIPTION: Fills the video memory with zeroes. 
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: fills all 256kB of VGA video memory with zeroes
+ *   SIDE EFFECTS: fills all 256kB of VGA video memory with zeroes; makes
+ *                 the next show_screen copy the view window
  */   
 void 
 clear_screens ()
@@ -573,7 +1017,11 @@ clear_screens ()
     SET_WRITE_MASK (0x0F00);
 
     /* Set 64kB to zero (times four planes = 256kB). */
-    memset (mem_image, 0, MODE_X_MEM_SIZE);
+    (*display->fill_mem) (0, 0, MODE_X_MEM_SIZE);
+
+    /* The screen shown and the status bar have been erased. */
+    screen_dirty = 1;
+    status_shown = 0;
 }
 
 
@@ -586,6 +1034,43 @@ clear_screens ()
 #if !defined(TEXT_RESTORE_PROGRAM)
 
 
+/*
+ * copy_vert_line
+ *   DESCRIPTION: Copy the image of a vertical map line into its plane of
+ *                the build buffer.  Four pixels are copied per loop
+ *                iteration, which roughly halves the time of the copy
+ *                when the game is built without optimization.
+ *   INPUTS: x -- the logical column of the line
+ *           buf -- image data for the line, starting at show_y
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer
+ */   
+static void
+copy_vert_line (int x, const unsigned char buf[SCROLL_Y_DIM])
+{
+    unsigned char* addr; /* address of next pixel in build buffer */
+    int i;		 /* loop index over pixels                */
+
+    /* Calculate address of first pixel, including its plane offset. */
+    addr = img3 + (x >> 2) + show_y * build_pitch + 
+	   (3 - (x & 3)) * plane_size;
+
+    /* Copy image data into appropriate plane in build buffer. */
+    for (i = 0; i + 4 <= SCROLL_Y_DIM; i += 4) {
+	addr[0] = buf[i];
+	addr[build_pitch] = buf[i + 1];
+	addr[2 * build_pitch] = buf[i + 2];
+	addr[3 * build_pitch] = buf[i + 3];
+	addr += 4 * build_pitch;
+    }
+    for (; i < SCROLL_Y_DIM; i++) {
+	*addr = buf[i];
+	addr += build_pitch;
+    }
+}
+
+
 /*
  * draw_vert_line
  *   DESCRIPTION: Draw a vertical map line into the build buffer.  The 
@@ -605,10 +1090,6 @@ draw_vert_line (int x)
 {
     /* to be written... */
     unsigned char buf[SCROLL_Y_DIM]; /* buffer for graphical image of line */
-    unsigned char* addr;             /* address of first pixel in build    */
-   				     /*     buffer (without plane offset)  */
-    int p_off;                       /* offset of plane of first pixel     */
-    int i;			     /* loop index over pixels             */
 
     /* Check whether requested line falls in the logical view window. */
     if (x < 0 || x >= SCROLL_X_DIM)
@@ -619,17 +1100,61 @@ draw_vert_line (int x)
 
     /* Get the image of the line. */
     (*vert_line_fn) (x, show_y, buf);
+    screen_dirty = 1;
 
-    /* Calculate starting address in build buffer. */
-    addr = img3 + (x >> 2) + show_y * SCROLL_X_WIDTH;
+    /* Copy image data into appropriate plane in build buffer. */
+    copy_vert_line (x, buf);
+    return 0;
+}
+
+
+/*
+ * draw_vert_strip
+ *   DESCRIPTION: Draw adjacent vertical map lines into the build buffer,
+ *                with the same result as calling draw_vert_line for each
+ *                of them.  The lines are obtained from the strip fill
+ *                function up to MAX_STRIP_WIDTH at a time, then copied 
+ *                into the build buffer one line at a time.  A piece of
+ *                the strip that is a single line is drawn with 
+ *                draw_vert_line.
+ *   INPUTS: x0 -- the 0-based pixel column number of the first line to be
+ *                 drawn within the logical view window
+ *           width -- number of lines to draw
+ *   OUTPUTS: none
+ *   RETURN VALUE: Returns 0 on success.  If any line is outside of the 
+ *                 valid SCROLL range, the function returns -1.  
+ *   SIDE EFFECTS: draws into the build buffer
+ */   
+int
+draw_vert_strip (int x0, int width)
+{
+    /* buffer for graphical image of strip */
+    unsigned char buf[MAX_STRIP_WIDTH][SCROLL_Y_DIM];
+    int w;                        /* number of lines in piece of strip   */
+    int x;                        /* logical column of first line        */
+    int j;                        /* loop index over lines               */
+
+    /* Check whether requested lines fall in the logical view window. */
+    if (x0 < 0 || width < 0 || x0 + width > SCROLL_X_DIM)
+	return -1;
 
-    /* Calculate plane offset of first pixel. */
-    p_off = (3 - (x & 3));
+    for (; width > 0; x0 += w, width -= w) {
+	w = (width > MAX_STRIP_WIDTH ? MAX_STRIP_WIDTH : width);
 
-    /* Copy image data into appropriate planes in build buffer. */
-    for (i = 0; i < SCROLL_Y_DIM; i++) {
-        addr[p_off * SCROLL_SIZE] = buf[i];
-	    addr+=SCROLL_X_WIDTH;
+	/* A single line gains nothing from the strip fill. */
+	if (w == 1) {
+	    (void)draw_vert_line (x0);
+	    continue;
+	}
+
+	/* Get the image of the lines at their logical position. */
+	x = show_x + x0;
+	(*strip_fn) (x, show_y, w, buf);
+	screen_dirty = 1;
+
+	/* Copy each line into its plane, as draw_vert_line does. */
+	for (j = 0; j < w; j++)
+	    copy_vert_line (x + j, buf[j]);
     }
     return 0;
 }
@@ -651,11 +1176,15 @@ draw_vert_line (int x)
 int
 draw_horiz_line (int y)
 {
-    unsigned char buf[SCROLL_X_DIM]; /* buffer for graphical image of line */
+    /* buffer for graphical image of line, starting at a multiple of 4 */
+    unsigned char buf[LINE_GROUPS * 4];
+    unsigned char strip[4][PLANE_STRIP]; /* line split into planes      */
     unsigned char* addr;             /* address of first pixel in build    */
    				     /*     buffer (without plane offset)  */
-    int p_off;                       /* offset of plane of first pixel     */
-    int i;			     /* loop index over pixels             */
+    int phase;                       /* x mod 4 of first pixel             */
+    int first;                       /* first group drawn in a plane       */
+    int last;                        /* group after last drawn in a plane  */
+    int p;			     /* loop index over planes             */
 
     /* Check whether requested line falls in the logical view window. */
     if (y < 0 || y >= SCROLL_Y_DIM)
@@ -664,122 +1193,804 @@ draw_horiz_line (int y)
     /* Adjust y to the logical row value. */
     y += show_y;
 
-    /* Get the image of the line. */
-    (*horiz_line_fn) (show_x, y, buf);
+    /* 
+     * Get the image of the line, placed so that pixels with x mod 4
+     * equal to p fall at positions p mod 4 in the buffer.
+     */
+    phase = (show_x & 3);
+    (*horiz_line_fn) (show_x, y, buf + phase);
+    screen_dirty = 1;
 
     /* Calculate starting address in build buffer. */
-    addr = img3 + (show_x >> 2) + y * SCROLL_X_WIDTH;
-
-    /* Calculate plane offset of first pixel. */
-    p_off = (3 - (show_x & 3));
+    addr = img3 + (show_x >> 2) + y * build_pitch;
 
-    /* Copy image data into appropriate planes in build buffer. */
-    for (i = 0; i < SCROLL_X_DIM; i++) {
-        addr[p_off * SCROLL_SIZE] = buf[i];
-	if (--p_off < 0) {
-	    p_off = 3;
-	    addr++;
-	}
+    /* 
+     * Split the line into planes, then copy each plane's part into the
+     * build buffer, skipping the groups that hold no pixels of the line.
+     * Pixels with x mod 4 equal to p go into build buffer plane 3 - p.
+     */
+    (*split_planes) (buf, LINE_GROUPS, strip[0], PLANE_STRIP);
+    for (p = 0; p < 4; p++) {
+	first = (p < phase);
+	last = (p < phase ? LINE_GROUPS : SCROLL_X_WIDTH);
+	memcpy (addr + (3 - p) * plane_size + first, strip[p] + first, 
+		last - first);
     }
 
     /* Return success. */
     return 0;
 }
 
-#endif /* !defined(TEXT_RESTORE_PROGRAM) */
-
 
 /*
- * open_memory_and_ports
- *   DESCRIPTION: Map video memory into our address space; obtain permission
- *                to access VGA ports.
- *   INPUTS: none
+ * draw_horiz_block
+ *   DESCRIPTION: Draw adjacent horizontal map lines into the build buffer,
+ *                with the same result as calling draw_horiz_line for each
+ *                of them.  The lines are obtained up to MAX_BLOCK_HEIGHT
+ *                at a time.  Each piece of the block is split into planes
+ *                in one pass, and each plane's part is then copied into
+ *                the build buffer with one memcpy.
+ *   INPUTS: y0 -- the 0-based pixel row number of the first line to be
+ *                 drawn within the logical view window
+ *           height -- number of lines to draw
  *   OUTPUTS: none
- *   RETURN VALUE: 0 on success, -1 on failure
- *   SIDE EFFECTS: prints an error message to stdout on failure
+ *   RETURN VALUE: Returns 0 on success.  If any line is outside of the 
+ *                 valid SCROLL range, the function returns -1.  
+ *   SIDE EFFECTS: draws into the build buffer
  */   
-static int
-open_memory_and_ports ()
+int
+draw_horiz_block (int y0, int height)
 {
-    int mem_fd;  /* file descriptor for physical memory image */
-
-    /* Obtain permission to access ports 0x03C0 through 0x03DA. */
-    if (ioperm (0x03C0, 0x03DA - 0x03C0 + 1, 1) == -1) {
-	perror ("set port permissions");
-	return -1;
-    }
+    /* 
+     * buffer for graphical image of block, with a group's worth of 
+     * space before the first line and after the last line
+     */
+    unsigned char blk[4 + MAX_BLOCK_HEIGHT * SCROLL_X_DIM + 4];
+    unsigned char (*rows)[SCROLL_X_DIM]; /* lines in block              */
+    unsigned char planes[4][BLOCK_GROUPS]; /* block split into planes */
+    unsigned char* addr;             /* address of first pixel in build    */
+   				     /*     buffer (without plane offset)  */
+    int phase;                       /* x mod 4 of first pixel             */
+    int h;                           /* number of lines in piece of block  */
+    int i;			     /* loop index over lines              */
+    int p;			     /* loop index over planes             */
 
-    /* Open file to access physical memory. */
-    if ((mem_fd = open ("/dev/mem", O_RDWR)) == -1) {
-        perror ("open /dev/mem");
+    /* Check whether requested lines fall in the logical view window. */
+    if (y0 < 0 || height < 0 || y0 + height > SCROLL_Y_DIM)
 	return -1;
-    }
 
-    /* Map video memory (0xA0000 - 0xBFFFF) into our address space. */
-    if ((mem_image = mmap (0, VID_MEM_SIZE, PROT_READ | PROT_WRITE,
-			   MAP_SHARED, mem_fd, 0xA0000)) == MAP_FAILED) {
-	perror ("mmap video memory");
-	return -1;
+    /* 
+     * The block is split into planes starting phase pixels before the
+     * first pixel of its first line, as draw_horiz_line splits a line.
+     * Since the lines are adjacent in the buffer, the groups of line i
+     * then start at group i * SCROLL_X_WIDTH in each plane.  The pixels
+     * split from outside of the block fall in groups that are not 
+     * drawn, so the space around the block only needs to hold 
+     * something.
+     */
+    rows = (unsigned char (*)[SCROLL_X_DIM])(blk + 4);
+    memset (blk, 0, 4);
+    memset (blk + 4 + MAX_BLOCK_HEIGHT * SCROLL_X_DIM, 0, 4);
+    phase = (show_x & 3);
+
+    for (; height > 0; y0 += h, height -= h) {
+	h = (height > MAX_BLOCK_HEIGHT ? MAX_BLOCK_HEIGHT : height);
+
+	/* Get the image of the lines at their logical position. */
+	(*block_fn) (show_x, show_y + y0, h, rows);
+	screen_dirty = 1;
+
+	/* 
+	 * Split the lines into planes, then copy each plane's part into
+	 * the build buffer.  Pixels with x mod 4 equal to p go into build 
+	 * buffer plane 3 - p; in planes before the phase, each line's 
+	 * first group holds no pixels of the line and is skipped.  With 
+	 * the default layout, the lines of a plane are as far apart in the
+	 * build buffer as in the split, so each plane takes one copy.
+	 */
+	(*split_planes) (rows[0] - phase, h * SCROLL_X_WIDTH + 1, planes[0],
+			 BLOCK_GROUPS);
+	addr = img3 + (show_x >> 2) + (show_y + y0) * build_pitch;
+	for (p = 0; p < 4; p++) {
+	    if (build_pitch == SCROLL_X_WIDTH) {
+		memcpy (addr + (3 - p) * plane_size + (p < phase), 
+			planes[p] + (p < phase), h * SCROLL_X_WIDTH);
+	    } else {
+		for (i = 0; i < h; i++)
+		    memcpy (addr + i * build_pitch + (3 - p) * plane_size + 
+			    (p < phase), 
+			    planes[p] + i * SCROLL_X_WIDTH + (p < phase), 
+			    SCROLL_X_WIDTH);
+	    }
+	}
     }
-
-    /* Close /dev/mem file descriptor and return success. */
-    (void)close (mem_fd);
     return 0;
 }
 
 
 /*
- * VGA_blank
- *   DESCRIPTION: Blank or unblank the VGA display.
- *   INPUTS: blank_bit -- set to 1 to blank, 0 to unblank
- *   OUTPUTS: none
+ * select_split_planes
+ *   DESCRIPTION: Choose the fastest version of split_planes supported by
+ *                the processor, then use it to split pixels.
+ *   INPUTS: src -- pixels (4 * groups of them)
+ *           groups -- number of groups of four pixels
+ *           stride -- distance in dst from one plane's pixels to the 
+ *                     next plane's
+ *   OUTPUTS: dst -- dst[p * stride + i] is set to src[4 * i + p]
  *   RETURN VALUE: none
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: sets split_planes
  */   
 static void
-VGA_blank (int blank_bit)
+select_split_planes (const unsigned char* src, int groups,
+		     unsigned char* dst, int stride)
 {
-    /* 
-     * Move blanking bit into position for VGA sequencer register 
-     * (index 1). 
-     */
-    blank_bit = ((blank_bit & 1) << 5);
-
-    asm volatile (
-	"movb $0x01,%%al         /* Set sequencer index to 1. */       ;"
-	"movw $0x03C4,%%dx                                             ;"
-	"outb %%al,(%%dx)                                              ;"
-	"incw %%dx                                                     ;"
-	"inb (%%dx),%%al         /* Read old value.           */       ;"
-	"andb $0xDF,%%al         /* Calculate new value.      */       ;"
-	"orl %0,%%eax                                                  ;"
-	"outb %%al,(%%dx)        /* Write new value.          */       ;"
-	"movw $0x03DA,%%dx       /* Enable display (0x20->P[0x3C0]) */ ;"
-	"inb (%%dx),%%al         /* Set attr reg state to index. */    ;"
-	"movw $0x03C0,%%dx       /* Write index 0x20 to enable. */     ;"
-	"movb $0x20,%%al                                               ;"
-	"outb %%al,(%%dx)                                               "
-      : : "g" (blank_bit) : "eax", "edx", "memory");
+    split_planes = split_planes_c;
+#if defined(__i386__) || defined(__x86_64__)
+    if (__builtin_cpu_supports ("avx2"))
+	split_planes = split_planes_avx2;
+    else if (__builtin_cpu_supports ("sse2"))
+	split_planes = split_planes_sse2;
+#endif
+    (*split_planes) (src, groups, dst, stride);
 }
 
 
 /*
- * set_seq_regs_and_reset
- *   DESCRIPTION: Set VGA sequencer registers and miscellaneous output
- *                register; array of registers should force a reset of
- *                the VGA sequencer, which is restored to normal operation
- *                after a brief delay.
- *   INPUTS: table -- table of sequencer register values to use
- *           val -- value to which miscellaneous output register should be set
- *   OUTPUTS: none
+ * split_planes_c
+ *   DESCRIPTION: Split groups of four pixels into one strip per plane,
+ *                one pixel at a time.
+ *   INPUTS: src -- pixels (4 * groups of them)
+ *           groups -- number of groups of four pixels
+ *           stride -- distance in dst from one plane's pixels to the 
+ *                     next plane's
+ *   OUTPUTS: dst -- dst[p * stride + i] is set to src[4 * i + p]
  *   RETURN VALUE: none
  *   SIDE EFFECTS: none
  */   
 static void
-set_seq_regs_and_reset (unsigned short table[NUM_SEQUENCER_REGS],
-			unsigned char val)
+split_planes_c (const unsigned char* src, int groups,
+		unsigned char* dst, int stride)
 {
-    /* 
+    int i; /* loop index over groups */
+
+    for (i = 0; i < groups; i++, src += 4) {
+	dst[i] = src[0];
+	dst[stride + i] = src[1];
+	dst[2 * stride + i] = src[2];
+	dst[3 * stride + i] = src[3];
+    }
+}
+
+
+#if defined(__i386__) || defined(__x86_64__)
+
+/*
+ * split_planes_sse2
+ *   DESCRIPTION: Split groups of four pixels into one strip per plane,
+ *                64 pixels at a time.  Each step packs the even bytes
+ *                and the odd bytes of two vectors into one vector each,
+ *                so two steps leave the bytes sorted by position mod 4.
+ *                Requires SSE2.
+ *   INPUTS: src -- pixels (4 * groups of them)
+ *           groups -- number of groups of four pixels
+ *           stride -- distance in dst from one plane's pixels to the 
+ *                     next plane's
+ *   OUTPUTS: dst -- dst[p * stride + i] is set to src[4 * i + p]
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+__attribute__ ((target ("sse2"))) static void
+split_planes_sse2 (const unsigned char* src, int groups,
+		   unsigned char* dst, int stride)
+{
+    __m128i lo = _mm_set1_epi16 (0x00FF); /* low byte of each word     */
+    __m128i a, b, c, d;     /* 64 pixels                               */
+    __m128i e0, o0, e1, o1; /* even and odd pixels of a:b and of c:d   */
+    int i;                  /* loop index over groups                  */
+
+    for (i = 0; i + 16 <= groups; i += 16, src += 64) {
+	a = _mm_loadu_si128 ((const __m128i*)src);
+	b = _mm_loadu_si128 ((const __m128i*)(src + 16));
+	c = _mm_loadu_si128 ((const __m128i*)(src + 32));
+	d = _mm_loadu_si128 ((const __m128i*)(src + 48));
+	e0 = _mm_packus_epi16 (_mm_and_si128 (a, lo), _mm_and_si128 (b, lo));
+	o0 = _mm_packus_epi16 (_mm_srli_epi16 (a, 8), _mm_srli_epi16 (b, 8));
+	e1 = _mm_packus_epi16 (_mm_and_si128 (c, lo), _mm_and_si128 (d, lo));
+	o1 = _mm_packus_epi16 (_mm_srli_epi16 (c, 8), _mm_srli_epi16 (d, 8));
+	_mm_storeu_si128 ((__m128i*)&dst[i], 
+			  _mm_packus_epi16 (_mm_and_si128 (e0, lo),
+					    _mm_and_si128 (e1, lo)));
+	_mm_storeu_si128 ((__m128i*)&dst[stride + i], 
+			  _mm_packus_epi16 (_mm_and_si128 (o0, lo),
+					    _mm_and_si128 (o1, lo)));
+	_mm_storeu_si128 ((__m128i*)&dst[2 * stride + i], 
+			  _mm_packus_epi16 (_mm_srli_epi16 (e0, 8),
+					    _mm_srli_epi16 (e1, 8)));
+	_mm_storeu_si128 ((__m128i*)&dst[3 * stride + i], 
+			  _mm_packus_epi16 (_mm_srli_epi16 (o0, 8),
+					    _mm_srli_epi16 (o1, 8)));
+    }
+    for (; i < groups; i++, src += 4) {
+	dst[i] = src[0];
+	dst[stride + i] = src[1];
+	dst[2 * stride + i] = src[2];
+	dst[3 * stride + i] = src[3];
+    }
+}
+
+
+/*
+ * split_planes_avx2
+ *   DESCRIPTION: Split groups of four pixels into one strip per plane,
+ *                128 pixels at a time.  A byte shuffle sorts the pixels
+ *                of each 16-byte lane by plane, a dword permute gathers
+ *                each plane's dwords of a vector into one half of a 
+ *                lane, and unpacks and lane permutes then assemble 32 
+ *                pixels of each plane.  The groups left over are split
+ *                by split_planes_sse2.  Requires AVX2.
+ *   INPUTS: src -- pixels (4 * groups of them)
+ *           groups -- number of groups of four pixels
+ *           stride -- distance in dst from one plane's pixels to the 
+ *                     next plane's
+ *   OUTPUTS: dst -- dst[p * stride + i] is set to src[4 * i + p]
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+__attribute__ ((target ("avx2"))) static void
+split_planes_avx2 (const unsigned char* src, int groups,
+		   unsigned char* dst, int stride)
+{
+    /* byte order that sorts each lane by plane */
+    __m256i by_plane = _mm256_setr_epi8 (0, 4, 8, 12, 1, 5, 9, 13, 
+					 2, 6, 10, 14, 3, 7, 11, 15,
+					 0, 4, 8, 12, 1, 5, 9, 13, 
+					 2, 6, 10, 14, 3, 7, 11, 15);
+    /* dword order that puts planes 0 and 1 in the low lane */
+    __m256i by_lane = _mm256_setr_epi32 (0, 4, 1, 5, 2, 6, 3, 7);
+    __m256i a, b, c, d;       /* 128 pixels, then sorted by plane      */
+    __m256i ab0, ab1;         /* planes 0/2 and 1/3 of a:b             */
+    __m256i cd0, cd1;         /* planes 0/2 and 1/3 of c:d             */
+    int i;                    /* loop index over groups                */
+
+    for (i = 0; i + 32 <= groups; i += 32, src += 128) {
+	a = _mm256_loadu_si256 ((const __m256i*)src);
+	b = _mm256_loadu_si256 ((const __m256i*)(src + 32));
+	c = _mm256_loadu_si256 ((const __m256i*)(src + 64));
+	d = _mm256_loadu_si256 ((const __m256i*)(src + 96));
+	a = _mm256_permutevar8x32_epi32 (_mm256_shuffle_epi8 (a, by_plane),
+					 by_lane);
+	b = _mm256_permutevar8x32_epi32 (_mm256_shuffle_epi8 (b, by_plane),
+					 by_lane);
+	c = _mm256_permutevar8x32_epi32 (_mm256_shuffle_epi8 (c, by_plane),
+					 by_lane);
+	d = _mm256_permutevar8x32_epi32 (_mm256_shuffle_epi8 (d, by_plane),
+					 by_lane);
+	ab0 = _mm256_unpacklo_epi64 (a, b);
+	ab1 = _mm256_unpackhi_epi64 (a, b);
+	cd0 = _mm256_unpacklo_epi64 (c, d);
+	cd1 = _mm256_unpackhi_epi64 (c, d);
+	_mm256_storeu_si256 ((__m256i*)&dst[i], 
+			     _mm256_permute2x128_si256 (ab0, cd0, 0x20));
+	_mm256_storeu_si256 ((__m256i*)&dst[stride + i], 
+			     _mm256_permute2x128_si256 (ab1, cd1, 0x20));
+	_mm256_storeu_si256 ((__m256i*)&dst[2 * stride + i], 
+			     _mm256_permute2x128_si256 (ab0, cd0, 0x31));
+	_mm256_storeu_si256 ((__m256i*)&dst[3 * stride + i], 
+			     _mm256_permute2x128_si256 (ab1, cd1, 0x31));
+    }
+
+    /* Leave the upper halves clear, so the SSE2 code runs at full speed. */
+    _mm256_zeroupper ();
+    split_planes_sse2 (src, groups - i, dst + i, stride);
+}
+
+#endif /* defined(__i386__) || defined(__x86_64__) */
+
+#endif /* !defined(TEXT_RESTORE_PROGRAM) */
+
+
+/*
+ * pick_display
+ *   DESCRIPTION: Find the display backend to use (see 
+ *                set_display_backend).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the backend, or NULL if the VGA was requested on a
+ *                 processor that has no I/O ports
+ *   SIDE EFFECTS: prints an error message to stdout on failure
+ */   
+static const display_ops_t*
+pick_display ()
+{
+    const char* env; /* value of MP2_HEADLESS */
+
+    if (backend == DISPLAY_DEFAULT) {
+	env = getenv ("MP2_HEADLESS");
+	if (env != NULL && env[0] != '\0' && strcmp (env, "0") != 0)
+	    return &emu_display;
+    } else if (backend == DISPLAY_HEADLESS) {
+	return &emu_display;
+    }
+#if defined(__i386__) || defined(__x86_64__)
+    return &vga_display;
+#else
+    puts ("VGA display requires an x86 processor; set MP2_HEADLESS=1");
+    return NULL;
+#endif
+}
+
+
+/*
+ * capture_frame
+ *   DESCRIPTION: Record the screen that the emulated VGA displays, if 
+ *                frames are being recorded.  Rows above the CRTC line 
+ *                compare (split screen) row are read from the CRTC start
+ *                address; the rows below it, from address 0.  Writes the
+ *                recorded frames first if SIGUSR1 has been received.
+ *   INPUTS: new_frame -- 1 to record a new frame, or 0 to replace the 
+ *                        most recent one
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may write files (see dump_frames)
+ */   
+static void
+capture_frame (int new_frame)
+{
+    frame_t* f;              /* frame being recorded                   */
+    unsigned int start;      /* CRTC start address                     */
+    unsigned int line_cmp;   /* CRTC line compare (scan line)          */
+    unsigned int split;      /* first pixel row read from address 0    */
+    unsigned int pitch;      /* bytes per row (CRTC offset)            */
+    unsigned int addr;       /* address of first pixel in row          */
+    int x, y;                /* loop indices over pixels               */
+
+    if (n_frames == 0 || display != &emu_display)
+        return;
+
+    if (new_frame && dump_wanted) {
+	dump_wanted = 0;
+	(void)dump_frames (FRAME_CAPTURE_PREFIX);
+    }
+    if (new_frame || frame_seq == 0)
+	frame_seq++;
+    f = &frames[(frame_seq - 1) % n_frames];
+    f->seq = frame_seq;
+
+    start = (emu.crtc[0x0C] << 8) | emu.crtc[0x0D];
+    line_cmp = emu.crtc[0x18] | ((emu.crtc[0x07] & 0x10) << 4) | 
+	       ((emu.crtc[0x09] & 0x40) << 3);
+    split = (line_cmp + 1) / ((emu.crtc[0x09] & 0x1F) + 1);
+    pitch = emu.crtc[0x13] * 2;
+    for (y = 0; y < FRAME_Y_DIM; y++) {
+	addr = ((unsigned int)y < split ? start + y * pitch :
+		(y - split) * pitch) & (MODE_X_MEM_SIZE - 1);
+	for (x = 0; x < IMAGE_X_WIDTH; x++) {
+	    f->pix[y][4 * x] = emu.plane[0][addr + x];
+	    f->pix[y][4 * x + 1] = emu.plane[1][addr + x];
+	    f->pix[y][4 * x + 2] = emu.plane[2][addr + x];
+	    f->pix[y][4 * x + 3] = emu.plane[3][addr + x];
+	}
+    }
+    memcpy (f->pal, emu.dac, sizeof (f->pal));
+}
+
+
+/*
+ * request_dump
+ *   DESCRIPTION: Signal handler for SIGUSR1; asks for the recorded 
+ *                frames to be written at the next show_screen.
+ *   INPUTS: sig -- the signal (ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+request_dump (int sig)
+{
+    dump_wanted = 1;
+}
+
+
+/*
+ * rep_outsw
+ *   DESCRIPTION: Write an array of two-byte values to two consecutive 
+ *                ports.
+ *   INPUTS: port -- first port
+ *           src -- values to write
+ *           count -- number of values
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+rep_outsw (unsigned short port, const unsigned short* src, int count)
+{
+    int i; /* loop index over values */
+
+    for (i = 0; i < count; i++)
+	OUTW (port, src[i]);
+}
+
+
+/*
+ * rep_outsb
+ *   DESCRIPTION: Write an array of one-byte values to a port.
+ *   INPUTS: port -- the port
+ *           src -- values to write
+ *           count -- number of values
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+rep_outsb (unsigned short port, const unsigned char* src, int count)
+{
+    int i; /* loop index over values */
+
+    for (i = 0; i < count; i++)
+	OUTB (port, src[i]);
+}
+
+
+#if defined(__i386__) || defined(__x86_64__)
+
+/*
+ * vga_open
+ *   DESCRIPTION: Map video memory into our address space; obtain permission
+ *                to access VGA ports.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: prints an error message to stdout on failure
+ */   
+static int
+vga_open ()
+{
+    int mem_fd;  /* file descriptor for physical memory image */
+
+    /* Obtain permission to access ports 0x03C0 through 0x03DA. */
+    if (ioperm (0x03C0, 0x03DA - 0x03C0 + 1, 1) == -1) {
+	perror ("set port permissions");
+	return -1;
+    }
+
+    /* Open file to access physical memory. */
+    if ((mem_fd = open ("/dev/mem", O_RDWR)) == -1) {
+        perror ("open /dev/mem");
+	return -1;
+    }
+
+    /* Map video memory (0xA0000 - 0xBFFFF) into our address space. */
+    if ((mem_image = mmap (0, VID_MEM_SIZE, PROT_READ | PROT_WRITE,
+			   MAP_SHARED, mem_fd, 0xA0000)) == MAP_FAILED) {
+	perror ("mmap video memory");
+	return -1;
+    }
+
+    /* Close /dev/mem file descriptor and return success. */
+    (void)close (mem_fd);
+    return 0;
+}
+
+
+/*
+ * vga_close
+ *   DESCRIPTION: Unmap video memory.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+vga_close ()
+{
+    (void)munmap (mem_image, VID_MEM_SIZE);
+}
+
+
+/*
+ * vga_out_b
+ *   DESCRIPTION: Write a byte to a VGA port.
+ *   INPUTS: port -- the port
+ *           val -- value to write
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+vga_out_b (unsigned short port, unsigned char val)
+{
+    asm volatile ("outb %b1,(%w0)"
+      : /* no outputs */
+      : "d" (port), "a" (val)
+      : "memory", "cc");
+}
+
+
+/*
+ * vga_out_w
+ *   DESCRIPTION: Write two bytes to two consecutive VGA ports.
+ *   INPUTS: port -- the first port
+ *           val -- value to write (low byte to port)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+vga_out_w (unsigned short port, unsigned short val)
+{
+    asm volatile ("outw %w1,(%w0)"
+      : /* no outputs */
+      : "d" (port), "a" (val)
+      : "memory", "cc");
+}
+
+
+/*
+ * vga_in_b
+ *   DESCRIPTION: Read a byte from a VGA port.
+ *   INPUTS: port -- the port
+ *   OUTPUTS: none
+ *   RETURN VALUE: the byte read
+ *   SIDE EFFECTS: none
+ */   
+static unsigned char
+vga_in_b (unsigned short port)
+{
+    unsigned char val; /* byte read */
+
+    asm volatile ("inb (%w1),%b0"
+      : "=a" (val)
+      : "d" (port)
+      : "memory");
+    return val;
+}
+
+
+/*
+ * vga_write_mem
+ *   DESCRIPTION: Copy data into video memory.
+ *   INPUTS: addr -- the destination offset in video memory
+ *           src -- data to copy
+ *           n -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+vga_write_mem (unsigned int addr, const void* src, unsigned int n)
+{
+    unsigned char* dst = mem_image + addr; /* destination address */
+
+    /* 
+     * memcpy is actually probably good enough here, and is usually
+     * implemented using ISA-specific features like those below,
+     * but the code here provides an example of x86 string moves
+     */
+    asm volatile (
+        "cld                                                 ;"
+       	"rep movsb    # copy ECX bytes from M[ESI] to M[EDI]  "
+      : "+S" (src), "+D" (dst), "+c" (n)
+      : /* no other inputs */
+      : "memory"
+    );
+}
+
+
+/*
+ * vga_fill_mem
+ *   DESCRIPTION: Fill part of video memory with one value.
+ *   INPUTS: addr -- the offset in video memory
+ *           val -- value to write
+ *           n -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+vga_fill_mem (unsigned int addr, unsigned char val, unsigned int n)
+{
+    memset (mem_image + addr, val, n);
+}
+
+#endif /* defined(__i386__) || defined(__x86_64__) */
+
+
+/*
+ * emu_open
+ *   DESCRIPTION: Reset the emulated VGA to its power-on state (all 
+ *                registers, memory, and palette colors zero).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: none
+ */   
+static int
+emu_open ()
+{
+    memset (&emu, 0, sizeof (emu));
+    return 0;
+}
+
+
+/*
+ * emu_close
+ *   DESCRIPTION: Release the emulated VGA (nothing to do; the state is
+ *                kept for inspection).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+emu_close ()
+{
+}
+
+
+/*
+ * emu_out_b
+ *   DESCRIPTION: Write a byte to an emulated VGA port.  Writes to ports
+ *                not used by this file are ignored.
+ *   INPUTS: port -- the port
+ *           val -- value to write
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+emu_out_b (unsigned short port, unsigned char val)
+{
+    switch (port) {
+	case 0x03C0:
+	    if (emu.attr_data)
+		emu.attr[emu.attr_idx] = val;
+	    else
+		emu.attr_idx = val & (EMU_REG_GROUP - 1);
+	    emu.attr_data ^= 1;
+	    break;
+	case 0x03C2: emu.misc = val; break;
+	case 0x03C4: emu.seq_idx = val & (EMU_REG_GROUP - 1); break;
+	case 0x03C5: emu.seq[emu.seq_idx] = val; break;
+	case 0x03C8: emu.dac_idx = val; emu.dac_rgb = 0; break;
+	case 0x03C9:
+	    emu.dac[emu.dac_idx][emu.dac_rgb] = val & 0x3F;
+	    if (++emu.dac_rgb == 3) {
+		emu.dac_rgb = 0;
+		emu.dac_idx++;
+	    }
+	    break;
+	case 0x03CE: emu.gfx_idx = val & (EMU_REG_GROUP - 1); break;
+	case 0x03CF: emu.gfx[emu.gfx_idx] = val; break;
+	case 0x03D4: emu.crtc_idx = val & (EMU_REG_GROUP - 1); break;
+	case 0x03D5: emu.crtc[emu.crtc_idx] = val; break;
+    }
+}
+
+
+/*
+ * emu_out_w
+ *   DESCRIPTION: Write two bytes to two consecutive emulated VGA ports.
+ *   INPUTS: port -- the first port
+ *           val -- value to write (low byte to port)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+emu_out_w (unsigned short port, unsigned short val)
+{
+    emu_out_b (port, val & 0xFF);
+    emu_out_b (port + 1, val >> 8);
+}
+
+
+/*
+ * emu_in_b
+ *   DESCRIPTION: Read a byte from an emulated VGA port.
+ *   INPUTS: port -- the port
+ *   OUTPUTS: none
+ *   RETURN VALUE: the byte read (0xFF for ports not emulated)
+ *   SIDE EFFECTS: reading 0x3DA makes the next 0x3C0 write an index
+ */   
+static unsigned char
+emu_in_b (unsigned short port)
+{
+    switch (port) {
+	case 0x03C5: return emu.seq[emu.seq_idx];
+	case 0x03CF: return emu.gfx[emu.gfx_idx];
+	case 0x03D5: return emu.crtc[emu.crtc_idx];
+	case 0x03DA: emu.attr_data = 0; return 0;
+    }
+    return 0xFF;
+}
+
+
+/*
+ * emu_write_mem
+ *   DESCRIPTION: Copy data into each emulated video memory plane enabled
+ *                by the sequencer's map mask register.
+ *   INPUTS: addr -- the destination offset in video memory
+ *           src -- data to copy
+ *           n -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+emu_write_mem (unsigned int addr, const void* src, unsigned int n)
+{
+    int i; /* loop index over planes */
+
+    for (i = 0; i < 4; i++)
+	if (emu.seq[0x02] & (1 << i))
+	    memcpy (emu.plane[i] + addr, src, n);
+}
+
+
+/*
+ * emu_fill_mem
+ *   DESCRIPTION: Fill part of each emulated video memory plane enabled
+ *                by the sequencer's map mask register with one value.
+ *   INPUTS: addr -- the offset in video memory
+ *           val -- value to write
+ *           n -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+emu_fill_mem (unsigned int addr, unsigned char val, unsigned int n)
+{
+    int i; /* loop index over planes */
+
+    for (i = 0; i < 4; i++)
+	if (emu.seq[0x02] & (1 << i))
+	    memset (emu.plane[i] + addr, val, n);
+}
+
+
+/*
+ * VGA_blank
+ *   DESCRIPTION: Blank or unblank the VGA display.
+ *   INPUTS: blank_bit -- set to 1 to blank, 0 to unblank
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+VGA_blank (int blank_bit)
+{
+    /* 
+     * Move blanking bit into position for VGA sequencer register 
+     * (index 1). 
+     */
+    blank_bit = ((blank_bit & 1) << 5);
+
+    OUTB (0x03C4, 0x01);                  /* Set sequencer index to 1.  */
+    OUTB (0x03C5, (INB (0x03C5) & 0xDF) | blank_bit); /* Read, write new */
+    (void)INB (0x03DA);                   /* Set attr reg state to index */
+    OUTB (0x03C0, 0x20);                  /* Write index 0x20 to enable  */
+}
+
+
+/*
+ * set_seq_regs_and_reset
+ *   DESCRIPTION: Set VGA sequencer registers and miscellaneous output
+ *                register; array of registers should force a reset of
+ *                the VGA sequencer, which is restored to normal operation
+ *                after a brief delay.
+ *   INPUTS: table -- table of sequencer register values to use
+ *           val -- value to which miscellaneous output register should be set
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+set_seq_regs_and_reset (unsigned short table[NUM_SEQUENCER_REGS],
+			unsigned char val)
+{
+    /* 
      * Dump table of values to sequencer registers.  Includes forced reset
      * as well as video blanking.
      */
@@ -827,9 +2038,7 @@ static void
 set_attr_registers (unsigned char table[NUM_ATTR_REGS * 2])
 {
     /* Reset attribute register to write index next rather than data. */
-    asm volatile (
-	"inb (%%dx),%%al"
-      : : "d" (0x03DA) : "eax", "memory");
+    (void)INB (0x03DA);
     REP_OUTSB (0x03C0, table, NUM_ATTR_REGS * 2);
 }
 
@@ -909,18 +2118,51 @@ fill_palette_mode_x ()
  * fill_entire_pallete
  *    DESCRIPTION:  Fill VGA palette with necessary colors for the adventure 
  *                game.  Only the last 192 (of 256) colors are written. 
+ *                A copy of the colors written since mode X was set is
+ *                kept, and only the runs of colors that differ from it 
+ *                are written, each starting with its own color index.
+ *                Rooms with similar palettes thus cost few port writes.
  * 
  *    INPUTS: image -- palette double pointer, 2D array
  *    OUTPUTS:  none
  *    RETURN VALUE: none
- *    SIDE EFFECTS: changes the last 192 palette colors 
+ *    SIDE EFFECTS: changes the last 192 palette colors; counts the port 
+ *                  writes made and saved in the display statistics
  * 
  * 
  */
 void fill_entire_palette(unsigned char **image)
 {
-    OUTB (0x03C8, 0x40);
-    REP_OUTSB (0x03C9, image, 192 * 3);
+    /* the colors, 6-bit RGB */
+    const unsigned char (*rgb)[3] = (const unsigned char (*)[3])image;
+    unsigned long writes = 0; /* port writes made           */
+    int first;                /* first color of run written */
+    int end;                  /* color after run written    */
+
+    /* Nothing is known about the palette, so write all of it. */
+    if (!dac_valid)
+	(void)memset (dac_shadow[0x40], 0xFF, 192 * 3);
+    dac_valid = 1;
+
+    /* 
+     * Write each run of changed colors.  Writing the unchanged colors 
+     * between two runs would cost three writes each instead of one 
+     * write to start the second run, so runs are never joined.
+     */
+    for (first = 0; first < 192; first = end) {
+	end = first + 1;
+	if (memcmp (dac_shadow[0x40 + first], rgb[first], 3) == 0)
+	    continue;
+	while (end < 192 && memcmp (dac_shadow[0x40 + end], rgb[end], 3) != 0)
+	    end++;
+	(void)memcpy (dac_shadow[0x40 + first], rgb[first], 
+		      (end - first) * 3);
+	OUTB (0x03C8, 0x40 + first);
+	REP_OUTSB (0x03C9, rgb[first], (end - first) * 3);
+	writes += 1 + (end - first) * 3;
+    }
+    stats.palette_writes += writes;
+    stats.palette_saved += 1 + 192 * 3 - writes;
 }
 
 /*
@@ -976,8 +2218,6 @@ static void
 write_font_data ()
 {
     int i;                /* loop index over characters                   */
-    int j;                /* loop index over font bytes within characters */
-    unsigned char* fonts; /* pointer into video memory                    */
 
     /* Prepare VGA to write font data into video memory. */
     OUTW (0x3C4, 0x0402);
@@ -986,12 +2226,12 @@ write_font_data ()
     OUTW (0x3CE, 0x0406);
     OUTW (0x3CE, 0x0204);
 
-    /* Copy font data from array into video memory. */
-    for (i = 0, fonts = mem_image; i < 256; i++) {
-	for (j = 0; j < 16; j++)
-	    fonts[j] = font_data[i][j];
-	fonts += 32; /* skip 16 bytes between characters */
-    }
+    /* 
+     * Copy font data from array into video memory, skipping 16 bytes 
+     * between characters.
+     */
+    for (i = 0; i < 256; i++)
+	(*display->write_mem) (i * 32, font_data[i], 16);
 
     /* Prepare VGA for text mode. */
     OUTW (0x3C4, 0x0302);
@@ -1013,8 +2253,8 @@ write_font_data ()
 static void
 set_text_mode_3 (int clear_scr)
 {
-    unsigned long* txt_scr; /* pointer to text screens in video memory */
-    int i;                  /* loop over text screen words             */
+    unsigned short txt_blank[1024]; /* blank text characters          */
+    int i;                          /* loop over text screen words    */
 
     VGA_blank (1);                               /* blank the screen        */
     /* 
@@ -1028,9 +2268,11 @@ set_text_mode_3 (int clear_scr)
     set_graphics_registers (text_graphics);      /* graphics registers      */
     fill_palette_text ();			 /* palette colors          */
     if (clear_scr) {				 /* clear screens if needed */
-	txt_scr = (unsigned long*)(mem_image + 0x18000); 
-	for (i = 0; i < 8192; i++)
-	    *txt_scr++ = 0x07200720;
+	for (i = 0; i < 1024; i++)
+	    txt_blank[i] = 0x0720;
+	for (i = 0; i < 16; i++)
+	    (*display->write_mem) (0x18000 + i * sizeof (txt_blank), 
+				   txt_blank, sizeof (txt_blank));
     }
     write_font_data ();                          /* copy fonts to video mem */
     VGA_blank (0);			         /* unblank the screen      */
@@ -1040,7 +2282,9 @@ set_text_mode_3 (int clear_scr)
 /*
  * copy_image
  *   DESCRIPTION: Copy one plane of a screen from the build buffer to the 
- *                video memory.
+ *                video memory, in one piece if the build buffer's rows 
+ *                are as wide as the screen's, and one row at a time if 
+ *                they are wider.
  *   INPUTS: img -- a pointer to a single screen plane in the build buffer
  *           scr_addr -- the destination offset in video memory
  *   OUTPUTS: none
@@ -1050,19 +2294,15 @@ set_text_mode_3 (int clear_scr)
 static void
 copy_image (unsigned char* img, unsigned short scr_addr)
 {
-    /* 
-     * memcpy is actually probably good enough here, and is usually
-     * implemented using ISA-specific features like those below,
-     * but the code here provides an example of x86 string moves
-     */
-    asm volatile (
-        "cld                                                 ;"
-       	"movl $14560,%%ecx                                   ;"
-       	"rep movsb    # copy ECX bytes from M[ESI] to M[EDI]  "
-      : /* no outputs */
-      : "S" (img), "D" (mem_image + scr_addr) 
-      : "eax", "ecx", "memory"
-    );
+    int i; /* loop index over rows */
+
+    if (build_pitch == SCROLL_X_WIDTH) {
+	(*display->write_mem) (scr_addr, img, SCROLL_SIZE);
+	return;
+    }
+    for (i = 0; i < SCROLL_Y_DIM; i++)
+	(*display->write_mem) (scr_addr + i * SCROLL_X_WIDTH, 
+			       img + i * build_pitch, SCROLL_X_WIDTH);
 }
 
 /*
@@ -1078,21 +2318,668 @@ copy_image (unsigned char* img, unsigned short scr_addr)
 static void
 copy_image_status (unsigned char* img, unsigned short scr_addr)
 {
+    (*display->write_mem) (scr_addr, img, STATUS_BAR_SIZE);
+}
+
+
+#if defined(MODEX_BENCHMARK)
+
+#include <time.h>
+
+/*
+ * The code below replaces the game with a benchmark of drawing into the
+ * build buffer, run on the headless display.  Lines are copied from a
+ * fixed pattern, so that fills cost little more than a photo's would.
+ * For each version of the plane 
+ * split used by draw_horiz_line, the whole view is drawn at every x 
+ * phase and compared with the build buffer produced by the original 
+ * pixel-at-a-time loop (kept below as draw_horiz_line_bytes), and the 
+ * time per line is reported.  Strips of each width at each x phase are 
+ * then checked against lines drawn one at a time, and scrolling right
+ * by 1, 2 and 6 pixels is timed both ways.  The pattern's strip fill 
+ * just fills one line after another, so this compares only the copies 
+ * into the build buffer; worldbench times the game's fills.
+ */
+
+#define BENCH_REPS 200	/* full views drawn for timing */
+
+/* bytes in the build buffer, including the memory fences (and most ever) */
+#define BUILD_BYTES     (build_size + 2 * MEM_FENCE_WIDTH)
+#define BUILD_BYTES_MAX (BUILD_BUF_LIMIT + 2 * MEM_FENCE_WIDTH)
+
+/* size of the photo held whole in the build buffer */
+#define BENCH_PHOTO_X 600
+#define BENCH_PHOTO_Y 400
+
+/* 
+ * pattern drawn by the fill functions, repeating every 256 rows and 
+ * 1024 columns (with the first SCROLL_X_DIM columns repeated at the end)
+ */
+static unsigned char bench_pix[256][1024 + SCROLL_X_DIM];
+
+/* versions of split_planes */
+static const struct {
+    const char* name;    /* name to print                    */
+    const char* feature; /* processor feature needed, or NULL */
+    void (*fn) (const unsigned char*, int, unsigned char*, int);
+} split_kernels[] = {
+    {"scalar", NULL, split_planes_c},
+#if defined(__i386__) || defined(__x86_64__)
+    {"sse2", "sse2", split_planes_sse2},
+    {"avx2", "avx2", split_planes_avx2},
+#endif
+};
+#define N_SPLIT_KERNELS (sizeof (split_kernels) / sizeof (split_kernels[0]))
+
+
+/* 
+ * cpu_supports
+ *   DESCRIPTION: Check whether the processor has a feature needed by a 
+ *                version of split_planes.
+ *   INPUTS: feature -- name of the feature, or NULL for none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if supported, 0 if not
+ *   SIDE EFFECTS: none
+ */
+static int
+cpu_supports (const char* feature)
+{
+    if (feature == NULL)
+	return 1;
+#if defined(__i386__) || defined(__x86_64__)
+    if (strcmp (feature, "sse2") == 0)
+	return (__builtin_cpu_supports ("sse2") != 0);
+    if (strcmp (feature, "avx2") == 0)
+	return (__builtin_cpu_supports ("avx2") != 0);
+#endif
+    return 0;
+}
+
+
+/*
+ * bench_horiz_fill
+ *   DESCRIPTION: Produce a horizontal line of a fixed pattern.
+ *   INPUTS: (x,y) -- leftmost pixel of line
+ *   OUTPUTS: buf -- image data for the line
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+bench_horiz_fill (int x, int y, unsigned char buf[SCROLL_X_DIM])
+{
+    memcpy (buf, &bench_pix[y & 255][x & 1023], SCROLL_X_DIM);
+}
+
+
+/*
+ * bench_vert_fill
+ *   DESCRIPTION: Produce a vertical line of the pattern made by 
+ *                bench_horiz_fill.
+ *   INPUTS: (x,y) -- top pixel of line
+ *   OUTPUTS: buf -- image data for the line
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+bench_vert_fill (int x, int y, unsigned char buf[SCROLL_Y_DIM])
+{
+    int i; /* loop index over pixels */
+
+    for (i = 0; i < SCROLL_Y_DIM; i++)
+	buf[i] = bench_pix[(y + i) & 255][x & 1023];
+}
+
+
+/*
+ * bench_strip_fill
+ *   DESCRIPTION: Produce adjacent vertical lines of the pattern made by 
+ *                bench_horiz_fill.
+ *   INPUTS: (x,y) -- top pixel of first line
+ *           width -- number of lines
+ *   OUTPUTS: buf -- image data for the lines, one line per row
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+bench_strip_fill (int x, int y, int width, 
+		  unsigned char buf[MAX_STRIP_WIDTH][SCROLL_Y_DIM])
+{
+    int j; /* loop index over lines */
+
+    for (j = 0; j < width; j++)
+	bench_vert_fill (x + j, y, buf[j]);
+}
+
+
+/*
+ * bench_block_fill
+ *   DESCRIPTION: Produce adjacent horizontal lines of the pattern made by 
+ *                bench_horiz_fill.
+ *   INPUTS: (x,y) -- leftmost pixel of first line
+ *           height -- number of lines
+ *   OUTPUTS: buf -- image data for the lines
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+bench_block_fill (int x, int y, int height, 
+		  unsigned char buf[MAX_BLOCK_HEIGHT][SCROLL_X_DIM])
+{
+    int i; /* loop index over lines */
+
+    for (i = 0; i < height; i++)
+	bench_horiz_fill (x, y + i, buf[i]);
+}
+
+
+/*
+ * draw_horiz_line_bytes
+ *   DESCRIPTION: Draw a horizontal line into the build buffer one pixel
+ *                at a time, as draw_horiz_line once did.
+ *   INPUTS: y -- row of the line within the logical view window
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: draws into the build buffer
+ */   
+static int
+draw_horiz_line_bytes (int y)
+{
+    unsigned char buf[SCROLL_X_DIM]; /* buffer for graphical image of line */
+    unsigned char* addr;             /* address of first pixel in build    */
+    int p_off;                       /* offset of plane of first pixel     */
+    int i;			     /* loop index over pixels             */
+
+    y += show_y;
+    (*horiz_line_fn) (show_x, y, buf);
+    addr = img3 + (show_x >> 2) + y * build_pitch;
+    p_off = (3 - (show_x & 3));
+    for (i = 0; i < SCROLL_X_DIM; i++) {
+        addr[p_off * plane_size] = buf[i];
+	if (--p_off < 0) {
+	    p_off = 3;
+	    addr++;
+	}
+    }
+    return 0;
+}
+
+
+/*
+ * draw_view
+ *   DESCRIPTION: Draw every row of the logical view window into a build
+ *                buffer filled with junk, starting at a given position.
+ *   INPUTS: (x,y) -- upper left pixel of logical view window
+ *           draw -- function used to draw each row
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: moves the view window; rewrites the build buffer 
+ *                 (but not the memory fence)
+ */   
+static void
+draw_view (int x, int y, int (*draw) (int))
+{
+    int i; /* loop index over build buffer and rows */
+
     /* 
-     * memcpy is actually probably good enough here, and is usually
-     * implemented using ISA-specific features like those below,
-     * but the code here provides an example of x86 string moves
+     * With the default layout, place the build buffer as set_view_window
+     * does for a view that does not overlap the old one, so that every
+     * view drawn starts from the same state.  A buffer holding a whole
+     * photo never moves.
      */
-    asm volatile (
-        "cld                                                 ;"
-       	"movl $1440,%%ecx                                   ;"
-       	"rep movsb    # copy ECX bytes from M[ESI] to M[EDI]  "
-      : /* no outputs */
-      : "S" (img), "D" (mem_image + scr_addr) 
-      : "eax", "ecx", "memory"
-    );
+    show_x = x;
+    show_y = y;
+    if (build_base != 0)
+	default_layout ();
+    for (i = 0; i < build_size; i++)
+	build[MEM_FENCE_WIDTH + i] = i * 31 + (i >> 8);
+    screen_dirty = 1;
+    for (i = 0; i < SCROLL_Y_DIM; i++)
+	(*draw) (i);
+}
+
+
+/* 
+ * elapsed_ms
+ *   DESCRIPTION: Calculate the time between two clock readings.
+ *   INPUTS: start -- earlier reading
+ *           end -- later reading
+ *   OUTPUTS: none
+ *   RETURN VALUE: elapsed time in milliseconds
+ *   SIDE EFFECTS: none
+ */
+static double
+elapsed_ms (const struct timespec* start, const struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000.0 + 
+	   (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+
+/*
+ * time_rows
+ *   DESCRIPTION: Time drawing every row of the view at each x phase.
+ *   INPUTS: draw -- function used to draw each row
+ *   OUTPUTS: none
+ *   RETURN VALUE: time per row in nanoseconds
+ *   SIDE EFFECTS: moves the view window; draws into the build buffer
+ */   
+static double
+time_rows (int (*draw) (int))
+{
+    struct timespec t0, t1; /* clock readings           */
+    int rep;                /* index over repetitions   */
+    int i;                  /* loop index over rows     */
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &t0);
+    for (rep = 0; rep < BENCH_REPS; rep++) {
+	set_view_window (rep & 3, 0);
+	for (i = 0; i < SCROLL_Y_DIM; i++)
+	    (*draw) (i);
+    }
+    (void)clock_gettime (CLOCK_MONOTONIC, &t1);
+    return elapsed_ms (&t0, &t1) * 1e6 / (BENCH_REPS * SCROLL_Y_DIM);
+}
+
+
+/*
+ * draw_cols
+ *   DESCRIPTION: Draw the columns exposed by scrolling the view right by
+ *                some number of pixels, either one at a time with 
+ *                draw_vert_line or all at once with draw_vert_strip.
+ *   INPUTS: width -- number of columns
+ *           strip -- non-zero to use draw_vert_strip
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer
+ */   
+static void
+draw_cols (int width, int strip)
+{
+    int i; /* loop index over columns */
+
+    if (strip) {
+	(void)draw_vert_strip (SCROLL_X_DIM - width, width);
+    } else {
+	for (i = 1; i <= width; i++)
+	    (void)draw_vert_line (SCROLL_X_DIM - i);
+    }
+}
+
+
+/*
+ * time_cols
+ *   DESCRIPTION: Time scrolling the view right across the pattern, 
+ *                drawing the exposed columns at each step.
+ *   INPUTS: width -- number of pixels moved per step
+ *           strip -- non-zero to use draw_vert_strip
+ *   OUTPUTS: none
+ *   RETURN VALUE: time per step in nanoseconds
+ *   SIDE EFFECTS: moves the view window; draws into the build buffer
+ */   
+static double
+time_cols (int width, int strip)
+{
+    struct timespec t0, t1; /* clock readings           */
+    int step;               /* index over scroll steps  */
+
+    set_view_window (0, 0);
+    (void)clock_gettime (CLOCK_MONOTONIC, &t0);
+    for (step = 1; step <= BENCH_REPS * 10; step++) {
+	set_view_window (step * width, 0);
+	draw_cols (width, strip);
+    }
+    (void)clock_gettime (CLOCK_MONOTONIC, &t1);
+    return elapsed_ms (&t0, &t1) * 1e6 / (BENCH_REPS * 10);
+}
+
+
+/*
+ * draw_rows
+ *   DESCRIPTION: Draw the rows exposed by scrolling the view down by
+ *                some number of pixels, either one at a time with 
+ *                draw_horiz_line or all at once with draw_horiz_block.
+ *   INPUTS: height -- number of rows
+ *           block -- non-zero to use draw_horiz_block
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer
+ */   
+static void
+draw_rows (int height, int block)
+{
+    int i; /* loop index over rows */
+
+    if (block) {
+	(void)draw_horiz_block (SCROLL_Y_DIM - height, height);
+    } else {
+	for (i = 1; i <= height; i++)
+	    (void)draw_horiz_line (SCROLL_Y_DIM - i);
+    }
+}
+
+
+/*
+ * time_redraw
+ *   DESCRIPTION: Time drawing the whole view, either one row at a time 
+ *                with draw_horiz_line or with draw_horiz_block.
+ *   INPUTS: block -- non-zero to use draw_horiz_block
+ *   OUTPUTS: none
+ *   RETURN VALUE: time per view in microseconds
+ *   SIDE EFFECTS: moves the view window; draws into the build buffer
+ */   
+static double
+time_redraw (int block)
+{
+    struct timespec t0, t1; /* clock readings   */
+    int rep;                /* index over views */
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &t0);
+    for (rep = 0; rep < BENCH_REPS; rep++) {
+	set_view_window (rep * 3, rep);
+	draw_rows (SCROLL_Y_DIM, block);
+    }
+    (void)clock_gettime (CLOCK_MONOTONIC, &t1);
+    return elapsed_ms (&t0, &t1) * 1e3 / BENCH_REPS;
+}
+
+
+/*
+ * time_show
+ *   DESCRIPTION: Time showing the same view over and over, either marking
+ *                the screen as changed before each show_screen or not.
+ *   INPUTS: changed -- non-zero to mark the screen as changed
+ *   OUTPUTS: none
+ *   RETURN VALUE: time per frame in microseconds
+ *   SIDE EFFECTS: draws into video memory
+ */   
+static double
+time_show (int changed)
+{
+    struct timespec t0, t1; /* clock readings    */
+    int rep;                /* index over frames */
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &t0);
+    for (rep = 0; rep < BENCH_REPS * 10; rep++) {
+	if (changed)
+	    screen_dirty = 1;
+	show_screen ();
+    }
+    (void)clock_gettime (CLOCK_MONOTONIC, &t1);
+    return elapsed_ms (&t0, &t1) * 1e3 / (BENCH_REPS * 10);
+}
+
+
+/*
+ * time_status
+ *   DESCRIPTION: Time setting up the status bar image, either from 
+ *                scratch, after typing or erasing a character, or with 
+ *                nothing changed.
+ *   INPUTS: how -- 0 from scratch, 1 after typing, 2 with nothing changed
+ *   OUTPUTS: none
+ *   RETURN VALUE: time per image in microseconds
+ *   SIDE EFFECTS: none
+ */   
+static double
+time_status (int how)
+{
+    static unsigned char img[2][STATUS_BAR_SIZE * 4]; /* images set up */
+    static const char* typed[2] = {"get wo", "get wor"}; /* typed text  */
+    struct timespec t0, t1; /* clock readings    */
+    int rep;                /* index over images */
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &t0);
+    for (rep = 0; rep < BENCH_REPS * 10; rep++)
+	(void)set_text_to_buffer ("the quad", typed[how < 2 ? rep & 1 : 0], 
+				  "", img[how == 0 ? rep & 1 : 0]);
+    (void)clock_gettime (CLOCK_MONOTONIC, &t1);
+    return elapsed_ms (&t0, &t1) * 1e3 / (BENCH_REPS * 10);
+}
+
+
+/*
+ * main -- for the "modexbench" program
+ *   DESCRIPTION: Check and time the build buffer drawing routines.
+ *   INPUTS: none (command line arguments are ignored)
+ *   OUTPUTS: prints one line of results per routine
+ *   RETURN VALUE: 0 if all routines match the originals, 3 otherwise
+ */   
+int
+main ()
+{
+    static unsigned char want[BUILD_BYTES_MAX]; /* original loop's buffer */
+    static unsigned char shown[FRAME_Y_DIM][IMAGE_X_DIM]; /* frame shown */
+    unsigned int k;       /* index over split kernels                  */
+    int x;                /* view x position (covers every phase)      */
+    int ok;               /* kernel matches original loop?             */
+    int ret_val = 0;      /* program return value                      */
+    double bytes_ns;      /* time per row for original loop            */
+    double ns;            /* time per row for draw_horiz_line          */
+    int i, j;             /* loop indices over pattern                 */
+    int w;                /* number of columns drawn                   */
+    int h;                /* number of rows drawn                      */
+    display_stats_t ds;   /* build buffer moves during the runs        */
+    int moves;            /* build buffer moves while scrolling        */
+    unsigned long shows;  /* frames presented before idle frames       */
+    unsigned long skips;  /* frames skipped before idle frames         */
+    static unsigned char pal[2][192][3]; /* palettes of two rooms      */
+    unsigned long long writes; /* palette port writes before switches  */
+
+    for (i = 0; i < 256; i++)
+	for (j = 0; j < 1024 + SCROLL_X_DIM; j++)
+	    bench_pix[i][j] = (j & 1023) * 7 + i * 13 + ((j & 1023) >> 3);
+
+    set_display_backend (DISPLAY_HEADLESS);
+    if (set_mode_X (bench_horiz_fill, bench_vert_fill, bench_strip_fill,
+		    bench_block_fill) == -1)
+	return 3;
+
+    bytes_ns = time_rows (draw_horiz_line_bytes);
+    printf ("draw_horiz_line bytes  %7.1f ns/line\n", bytes_ns);
+    for (k = 0; k < N_SPLIT_KERNELS; k++) {
+	if (!cpu_supports (split_kernels[k].feature)) {
+	    printf ("draw_horiz_line %-6s not supported\n", 
+		    split_kernels[k].name);
+	    continue;
+	}
+	split_planes = split_kernels[k].fn;
+	for (ok = 1, x = 0; ok && x < 8; x++) {
+	    draw_view (x + 1000, 37, draw_horiz_line_bytes);
+	    memcpy (want, build, BUILD_BYTES);
+	    draw_view (x + 1000, 37, draw_horiz_line);
+	    ok = (memcmp (want, build, BUILD_BYTES) == 0);
+	}
+	if (!ok)
+	    ret_val = 3;
+	ns = time_rows (draw_horiz_line);
+	printf ("draw_horiz_line %-6s %7.1f ns/line  %5.1fx  %s\n", 
+		split_kernels[k].name, ns, bytes_ns / ns, 
+		(ok ? "identical" : "MISMATCH"));
+    }
+
+    /* 
+     * Check that strips of each width at each phase draw the same build
+     * buffer as single lines, then time scrolling with each.
+     */
+    for (w = 1; w <= 2 * MAX_STRIP_WIDTH + 1; w++) {
+	for (ok = 1, x = 0; ok && x < 4; x++) {
+	    draw_view (x + 1000, 37, draw_horiz_line);
+	    set_view_window (x + 1000 + w, 37);
+	    draw_cols (w, 0);
+	    memcpy (want, build, BUILD_BYTES);
+	    draw_view (x + 1000, 37, draw_horiz_line);
+	    set_view_window (x + 1000 + w, 37);
+	    draw_cols (w, 1);
+	    ok = (memcmp (want, build, BUILD_BYTES) == 0);
+	}
+	if (!ok)
+	    ret_val = 3;
+	if (w == 1 || w == 2 || w == 6 || !ok) {
+	    bytes_ns = time_cols (w, 0);
+	    ns = time_cols (w, 1);
+	    printf ("scroll %2d columns  lines %7.1f ns  strip %7.1f ns  "
+		    "%5.1fx  %s\n", w, bytes_ns, ns, bytes_ns / ns,
+		    (ok ? "identical" : "MISMATCH"));
+	}
+    }
+
+    /* 
+     * Check that blocks of each height at each phase draw the same build
+     * buffer as single lines with each version of the plane split, then
+     * time redrawing the whole view with each.
+     */
+    for (ok = 1, k = 0; ok && k < N_SPLIT_KERNELS; k++) {
+	if (!cpu_supports (split_kernels[k].feature))
+	    continue;
+	split_planes = split_kernels[k].fn;
+	for (h = 1; h <= SCROLL_Y_DIM; 
+	     h = (h == 2 * MAX_BLOCK_HEIGHT + 1 ? SCROLL_Y_DIM : h + 1)) {
+	    for (x = 0; ok && x < 4; x++) {
+		draw_view (x + 1000, 37, draw_horiz_line);
+		set_view_window (x + 1000, 37 + h);
+		draw_rows (h, 0);
+		memcpy (want, build, BUILD_BYTES);
+		draw_view (x + 1000, 37, draw_horiz_line);
+		set_view_window (x + 1000, 37 + h);
+		draw_rows (h, 1);
+		ok = (memcmp (want, build, BUILD_BYTES) == 0);
+	    }
+	    if (!ok) {
+		printf ("draw_horiz_block %s %d rows MISMATCH\n", 
+			split_kernels[k].name, h);
+		ret_val = 3;
+		break;
+	    }
+	}
+    }
+    split_planes = select_split_planes;
+    bytes_ns = time_redraw (0);
+    ns = time_redraw (1);
+    printf ("redraw view  lines %7.1f us  block %7.1f us  %5.1fx  %s\n", 
+	    bytes_ns, ns, bytes_ns / ns, (ok ? "identical" : "MISMATCH"));
+
+    /* 
+     * Check that a build buffer holding a whole photo shows the same 
+     * frames as the default layout, then scroll across the photo in 
+     * steps of a few pixels, drawing only what is exposed, and check 
+     * that the buffer never moves and the last frame is still right.
+     */
+    (void)set_frame_capture (1);
+    for (ok = 1, x = 0; ok && x < 4; x++) {
+	(void)size_build_buffer (0, 0);
+	draw_view (x + 250, 190, draw_horiz_line);
+	show_screen ();
+	memcpy (shown, frames[0].pix, sizeof (shown));
+	if (size_build_buffer (BENCH_PHOTO_X, BENCH_PHOTO_Y) != 1)
+	    ok = 0;
+	draw_view (x + 250, 190, draw_horiz_line);
+	show_screen ();
+	ok = ok && (memcmp (shown, frames[0].pix, sizeof (shown)) == 0);
+    }
+    get_display_stats (&ds);
+    moves = ds.relocations + ds.recenterings;
+    draw_view (0, 0, draw_horiz_line);
+    for (x = 0; x + 7 <= BENCH_PHOTO_X - SCROLL_X_DIM; x += 7) {
+	set_view_window (x + 7, 0);
+	draw_cols (7, 1);
+    }
+    for (i = 0; i + 5 <= BENCH_PHOTO_Y - SCROLL_Y_DIM; i += 5) {
+	set_view_window (x, i + 5);
+	draw_rows (5, 1);
+    }
+    show_screen ();
+    memcpy (shown, frames[0].pix, sizeof (shown));
+    get_display_stats (&ds);
+    moves = ds.relocations + ds.recenterings - moves;
+    draw_view (x, i, draw_horiz_line);
+    show_screen ();
+    ok = ok && moves == 0 && 
+	 (memcmp (shown, frames[0].pix, sizeof (shown)) == 0);
+    if (!ok)
+	ret_val = 3;
+    printf ("whole photo layout  %d build buffer moves  %s\n", moves,
+	    (ok ? "identical" : "MISMATCH"));
+    (void)set_frame_capture (0);
+    (void)size_build_buffer (0, 0);
+
+    /* 
+     * Check that showing a view that has not changed skips the copy and
+     * leaves the same frame on the display, and that drawing a line or
+     * moving the view shows the screen again, then time each kind of 
+     * frame.
+     */
+    (void)set_frame_capture (1);
+    draw_view (250, 190, draw_horiz_line);
+    show_screen ();
+    memcpy (shown, frames[0].pix, sizeof (shown));
+    get_display_stats (&ds);
+    shows = ds.presented;
+    skips = ds.skipped;
+    set_view_window (250, 190);
+    show_screen ();
+    show_screen ();
+    ok = (memcmp (shown, frames[0].pix, sizeof (shown)) == 0);
+    (void)draw_horiz_line (0);
+    show_screen ();
+    set_view_window (251, 190);
+    show_screen ();
+    get_display_stats (&ds);
+    ok = ok && ds.presented - shows == 2 && ds.skipped - skips == 2;
+    if (!ok)
+	ret_val = 3;
+    (void)set_frame_capture (0);
+    bytes_ns = time_show (1);
+    ns = time_show (0);
+    printf ("idle frame  shown %7.2f us  skipped %7.2f us  %5.1fx  %s\n",
+	    bytes_ns, ns, bytes_ns / ns, (ok ? "identical" : "MISMATCH"));
+
+    /* 
+     * Switch back and forth between the palettes of two rooms that 
+     * differ in a few runs of colors, checking that the VGA ends up with
+     * each palette, and count the port writes made per switch.
+     */
+    for (i = 0; i < 192; i++)
+	for (j = 0; j < 3; j++)
+	    pal[0][i][j] = pal[1][i][j] = (i * 5 + j * 17) & 0x3F;
+    for (i = 10; i < 15; i++)
+	pal[1][i][0] ^= 0x20;
+    pal[1][100][2] ^= 0x01;
+    for (i = 170; i < 182; i++)
+	pal[1][i][1] ^= 0x10;
+    fill_entire_palette ((unsigned char**)pal[0]);
+    get_display_stats (&ds);
+    writes = ds.palette_writes;
+    for (ok = 1, i = 0; i < 100; i++) {
+	fill_entire_palette ((unsigned char**)pal[(i & 1) ^ 1]);
+	ok = ok && memcmp (emu.dac[0x40], pal[(i & 1) ^ 1], 192 * 3) == 0;
+    }
+    if (!ok)
+	ret_val = 3;
+    get_display_stats (&ds);
+    printf ("palette switch  all %d writes  changed %.1f writes  %s\n",
+	    1 + 192 * 3, (ds.palette_writes - writes) / 100.0, 
+	    (ok ? "identical" : "MISMATCH"));
+
+    /* Time setting up the status bar image. */
+    bytes_ns = time_status (0);
+    ns = time_status (1);
+    printf ("status bar  whole %7.2f us  typed %7.2f us  unchanged %7.2f us\n",
+	    bytes_ns, ns, time_status (2));
+
+    /* Report how often the build buffer moved during the runs above. */
+    get_display_stats (&ds);
+    printf ("build buffer  %lu relocations (%.1f kB each)  "
+	    "%lu recenterings\n", ds.relocations, 
+	    ds.bytes_moved / 1024.0 / (ds.relocations ? ds.relocations : 1),
+	    ds.recenterings);
+    printf ("frames  %lu presented  %lu skipped\n", ds.presented, 
+	    ds.skipped);
+
+    clear_mode_X ();
+    return ret_val;
 }
 
+#endif /* defined(MODEX_BENCHMARK) */
+
 
 #if defined(TEXT_RESTORE_PROGRAM)
 
@@ -1110,14 +2997,14 @@ int
 main ()
 {
     /* Map video memory and obtain permission for VGA port access. */
-    if (open_memory_and_ports () == -1)
+    if ((display = pick_display ()) == NULL || (*display->open) () == -1)
         return 3;
 
     /* Put VGA into text mode without clearing the screen. */
     set_text_mode_3 (0);
 
     /* Unmap video memory. */ 
-    (void)munmap (mem_image, VID_MEM_SIZE);
+    (*display->close) ();
 
     /* Return success. */
     return 0;
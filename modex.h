@@ -60,6 +60,12 @@
 #define SCROLL_Y_DIM    IMAGE_Y_DIM                /* full image width      */
 #define SCROLL_X_WIDTH  (IMAGE_X_DIM / 4)          /* addresses (bytes)     */
 
+/* widest strip of columns produced by one call to a strip fill function */
+#define MAX_STRIP_WIDTH 16
+
+/* tallest block of rows produced by one call to a block fill function */
+#define MAX_BLOCK_HEIGHT 16
+
 #define STATUS_BAR_SIZE  1440	// size of the status bar plane -> (18 * IMAGE_X_DIM)/4
 
 /*
@@ -113,24 +119,75 @@
  * is drawn.  Other data are left untouched in most cases.
  */
 
+/* displays that can be used by the mode X code */
+typedef enum {
+    DISPLAY_DEFAULT,  /* headless if MP2_HEADLESS is set, otherwise VGA */
+    DISPLAY_VGA,      /* the VGA, through /dev/mem and I/O ports        */
+    DISPLAY_HEADLESS  /* a VGA emulated in memory                       */
+} display_backend_t;
+
+/* 
+ * counts of the work done by the display since set_mode_X (printed to 
+ * stderr by clear_mode_X if MP2_STATS is set in the environment)
+ */
+typedef struct {
+    unsigned long      relocations;  /* build buffer moves keeping data */
+    unsigned long long bytes_moved;  /* bytes copied by those moves     */
+    unsigned long      recenterings; /* build buffer moves keeping none */
+    unsigned long      presented;    /* frames copied to video memory   */
+    unsigned long      skipped;      /* frames unchanged since last one */
+    unsigned long long palette_writes; /* palette port writes made      */
+    unsigned long long palette_saved;  /* palette port writes not needed */
+} display_stats_t;
+
+/* choose the display used by the next call to set_mode_X */
+extern void set_display_backend (display_backend_t b);
+
 /* configure VGA for mode X; initializes logical view to (0,0) */
 extern int set_mode_X (void (*horiz_fill_fn)
                             (int, int, unsigned char[SCROLL_X_DIM]),
 		       void (*vert_fill_fn) 
-		            (int, int, unsigned char[SCROLL_Y_DIM]));
+		            (int, int, unsigned char[SCROLL_Y_DIM]),
+		       void (*strip_fill_fn) 
+		            (int, int, int, 
+			     unsigned char[MAX_STRIP_WIDTH][SCROLL_Y_DIM]),
+		       void (*block_fill_fn) 
+		            (int, int, int, 
+			     unsigned char[MAX_BLOCK_HEIGHT][SCROLL_X_DIM]));
 
 /* return to text mode */
 extern void clear_mode_X ();
 
+/* 
+ * lay out the build buffer for a room photo; returns 1 if it holds the 
+ * whole photo, or 0 if it uses the default layout
+ */
+extern int size_build_buffer (int width, int height);
+
 /* set logical view window coordinates */
 extern void set_view_window (int scr_x, int scr_y);
 
+/* get counts of the work done by the display since set_mode_X */
+extern void get_display_stats (display_stats_t* s);
+
 /* show the logical view window on the monitor */
 extern void show_screen ();
 
 /* show the status bar on the monitor*/
 extern void show_status_bar (const char* s, const char * input, const char * status_msg);
 
+/* 
+ * record the last n frames shown (headless display only; 0 to stop);
+ * returns 0 on success, -1 if out of memory
+ */
+extern int set_frame_capture (int n);
+
+/* 
+ * write the recorded frames as PPM files; returns the number written, 
+ * or -1 on failure
+ */
+extern int dump_frames (const char* prefix);
+
 /* clear the video memory in mode X */
 extern void clear_screens ();
 
@@ -140,6 +197,22 @@ extern int draw_horiz_line (int y);
 /* draw a vertical line at horizontal pixel x within the logical view window */
 extern int draw_vert_line (int x);
 
+/* 
+ * draw width vertical lines starting at horizontal pixel x0 within the 
+ * logical view window
+ */
+extern int draw_vert_strip (int x0, int width);
+
+/* 
+ * draw height horizontal lines starting at vertical pixel y0 within the 
+ * logical view window
+ */
+extern int draw_horiz_block (int y0, int height);
+
+/* 
+ * set the 192 room photo colors (64 and up) in the VGA palette, writing 
+ * only the colors that have changed
+ */
 void fill_entire_palette(unsigned char **image);
 
 #endif /* MODEX_H */
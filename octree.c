@@ -0,0 +1,555 @@
+/*									tab:8
+ *
+ * octree.c - octree color quantizer
+ *
+ * See octree.h for an overview.  The tree is stored as one array of nodes
+ * per level rather than with pointers: the node for a color at level L is
+ * found by concatenating the L most significant bits of each of its red,
+ * green, and blue components (red highest), so parents and children can
+ * be located by arithmetic alone.  Pixels are counted only at the deepest
+ * level; octree_reduce then sums the counts upward before merging.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "octree.h"
+
+
+/* node states */
+typedef enum {
+    NODE_EMPTY,		/* no pixels at or below this node          */
+    NODE_INNER,		/* pixels are held by leaves below the node */
+    NODE_LEAF,		/* node provides a palette color            */
+    NODE_MERGED		/* node has been merged into its parent     */
+} node_state_t;
+
+typedef struct octree_node_t octree_node_t;
+struct octree_node_t {
+    uint32_t count;	/* number of pixels at or below node         */
+    uint32_t sum[3];	/* sums of 6-bit red, green, and blue values */
+    uint8_t  state;	/* a node_state_t value                     */
+    uint8_t  index;	/* palette index (leaves only)               */
+};
+
+struct octree_t {
+    octree_node_t* level[OCTREE_DEPTH + 1]; /* nodes at each level      */
+    int32_t        n_colors;                 /* colors after reduction   */
+    uint8_t        color[OCTREE_MAX_COLORS][3]; /* palette (6-bit RGB)  */
+};
+
+/*
+ * sort record used for choosing nodes to merge and for numbering leaves;
+ * the level and index make every record distinct, so sorting is
+ * deterministic even though qsort is not stable
+ */
+typedef struct sort_rec_t sort_rec_t;
+struct sort_rec_t {
+    uint32_t count;	/* pixels at or below node */
+    int32_t  level;	/* level of node in tree   */
+    int32_t  idx;	/* index of node in level  */
+};
+
+
+/* local functions--see function headers for details */
+static int32_t child_index (int32_t level, int32_t idx, int32_t child);
+static int32_t parent_index (int32_t level, int32_t idx);
+static int by_count_up (const void* a, const void* b);
+static int by_count_down (const void* a, const void* b);
+
+
+/*
+ * child_index
+ *   DESCRIPTION: Find the index of one of the eight children of a node.
+ *   INPUTS: level -- level of the node (less than OCTREE_DEPTH)
+ *           idx -- index of the node within its level
+ *           child -- which child (bit 2 red, bit 1 green, bit 0 blue)
+ *   OUTPUTS: none
+ *   RETURN VALUE: index of the child within the next level
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+child_index (int32_t level, int32_t idx, int32_t child)
+{
+    int32_t mask = (1 << level) - 1; /* one component of idx */
+
+    return ((((idx >> (2 * level)) << 1) | ((child >> 2) & 1))
+    		<< (2 * level + 2)) |
+	   (((((idx >> level) & mask) << 1) | ((child >> 1) & 1))
+	   	<< (level + 1)) |
+	   (((idx & mask) << 1) | (child & 1));
+}
+
+
+/*
+ * parent_index
+ *   DESCRIPTION: Find the index of the parent of a node.
+ *   INPUTS: level -- level of the node (greater than 0)
+ *           idx -- index of the node within its level
+ *   OUTPUTS: none
+ *   RETURN VALUE: index of the parent within the previous level
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+parent_index (int32_t level, int32_t idx)
+{
+    int32_t mask = (1 << level) - 1; /* one component of idx */
+
+    return ((idx >> (2 * level + 1)) << (2 * level - 2)) |
+	   ((((idx >> level) & mask) >> 1) << (level - 1)) |
+	   ((idx & mask) >> 1);
+}
+
+
+/*
+ * by_count_up
+ *   DESCRIPTION: qsort comparison putting the fewest pixels first, with
+ *                ties broken by level, then by index.
+ *   INPUTS: a, b -- pointers to sort_rec_t structures
+ *   OUTPUTS: none
+ *   RETURN VALUE: negative, zero, or positive as a belongs before, with,
+ *                 or after b
+ *   SIDE EFFECTS: none
+ */
+static int
+by_count_up (const void* a, const void* b)
+{
+    const sort_rec_t* ra = a;
+    const sort_rec_t* rb = b;
+
+    if (ra->count != rb->count) {
+        return (ra->count < rb->count ? -1 : 1);
+    }
+    if (ra->level != rb->level) {
+        return ra->level - rb->level;
+    }
+    return ra->idx - rb->idx;
+}
+
+
+/*
+ * by_count_down
+ *   DESCRIPTION: qsort comparison putting the most pixels first, with
+ *                ties broken by level, then by index.
+ *   INPUTS: a, b -- pointers to sort_rec_t structures
+ *   OUTPUTS: none
+ *   RETURN VALUE: negative, zero, or positive as a belongs before, with,
+ *                 or after b
+ *   SIDE EFFECTS: none
+ */
+static int
+by_count_down (const void* a, const void* b)
+{
+    const sort_rec_t* ra = a;
+    const sort_rec_t* rb = b;
+
+    if (ra->count != rb->count) {
+        return (ra->count > rb->count ? -1 : 1);
+    }
+    if (ra->level != rb->level) {
+        return ra->level - rb->level;
+    }
+    return ra->idx - rb->idx;
+}
+
+
+/*
+ * octree_create
+ *   DESCRIPTION: Create an empty quantizer.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the new quantizer, or NULL on failure
+ *   SIDE EFFECTS: dynamically allocates memory
+ */
+octree_t*
+octree_create ()
+{
+    octree_t*      t;     /* new quantizer                 */
+    octree_node_t* nodes; /* storage for nodes of all levels */
+    int32_t        total; /* number of nodes in all levels   */
+    int32_t        l;     /* index over levels               */
+
+    for (total = 0, l = 0; OCTREE_DEPTH >= l; l++) {
+        total += (1 << (3 * l));
+    }
+    if (NULL == (t = malloc (sizeof (*t)))) {
+        return NULL;
+    }
+    if (NULL == (nodes = calloc (total, sizeof (nodes[0])))) {
+        free (t);
+	return NULL;
+    }
+    for (l = 0; OCTREE_DEPTH >= l; l++) {
+        t->level[l] = nodes;
+	nodes += (1 << (3 * l));
+    }
+    t->n_colors = 0;
+    return t;
+}
+
+
+/*
+ * octree_destroy
+ *   DESCRIPTION: Release a quantizer.
+ *   INPUTS: t -- the quantizer
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees dynamically allocated memory
+ */
+void
+octree_destroy (octree_t* t)
+{
+    free (t->level[0]);
+    free (t);
+}
+
+
+/*
+ * octree_add_pixel
+ *   DESCRIPTION: Count one pixel toward the palette.  The pixel's 5-bit
+ *                red and blue values are widened to 6 bits by repeating
+ *                their high bits, so that full intensity stays at 63.
+ *   INPUTS: t -- the quantizer
+ *           pixel -- 5:6:5 RGB pixel
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+octree_add_pixel (octree_t* t, uint16_t pixel)
+{
+    octree_node_t* node = &t->level[OCTREE_DEPTH][OCTREE_KEY (pixel)];
+    uint32_t       r = (pixel >> 11);
+    uint32_t       b = (pixel & 0x1F);
+
+    node->count++;
+    node->sum[0] += (r << 1) | (r >> 4);
+    node->sum[1] += (pixel >> 5) & 0x3F;
+    node->sum[2] += (b << 1) | (b >> 4);
+}
+
+
+/*
+ * octree_reduce
+ *   DESCRIPTION: Turn the pixel counts into a palette.  Counts and sums
+ *                are first added up the tree.  Then, one level at a time
+ *                starting just above the deepest level, nodes are merged
+ *                with their children (all of which are leaves by then),
+ *                fewest pixels first, until no more than n_colors leaves
+ *                remain.  Finally, leaves are numbered from most pixels
+ *                to fewest, and each leaf's color is set to the average
+ *                of its pixels.
+ *   INPUTS: t -- the quantizer
+ *           n_colors -- maximum number of palette colors
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of palette colors produced
+ *   SIDE EFFECTS: changes the tree; must be called only once
+ */
+int32_t
+octree_reduce (octree_t* t, int32_t n_colors)
+{
+    static const int32_t n_recs = (1 << (3 * (OCTREE_DEPTH - 1)));
+    sort_rec_t*    rec;      /* candidates for merging, then leaves */
+    int32_t        n_leaves; /* number of leaves in tree            */
+    int32_t        n;        /* number of records in use            */
+    int32_t        l;        /* index over levels                   */
+    int32_t        idx;      /* index over nodes within level       */
+    int32_t        i;        /* index over records                  */
+    int32_t        c;        /* index over children                 */
+    int32_t        merged;   /* leaves merged into one node         */
+    octree_node_t* node;     /* node being examined                 */
+    octree_node_t* up;       /* parent or child of node             */
+
+    if (1 > n_colors) {
+        n_colors = 1;
+    }
+    if (OCTREE_MAX_COLORS < n_colors) {
+        n_colors = OCTREE_MAX_COLORS;
+    }
+    if (NULL == (rec = malloc (n_recs * sizeof (rec[0])))) {
+        t->n_colors = 0;
+        return 0;
+    }
+
+    /* Add counts and sums up the tree; nonempty bottom nodes are leaves. */
+    n_leaves = 0;
+    for (l = OCTREE_DEPTH; 0 < l; l--) {
+        for (idx = 0; (1 << (3 * l)) > idx; idx++) {
+	    node = &t->level[l][idx];
+	    if (0 == node->count) {
+	        continue;
+	    }
+	    if (OCTREE_DEPTH == l) {
+	        node->state = NODE_LEAF;
+		n_leaves++;
+	    }
+	    up = &t->level[l - 1][parent_index (l, idx)];
+	    up->count += node->count;
+	    up->sum[0] += node->sum[0];
+	    up->sum[1] += node->sum[1];
+	    up->sum[2] += node->sum[2];
+	    up->state = NODE_INNER;
+	}
+    }
+
+    /* Merge the smallest nodes, one level at a time. */
+    for (l = OCTREE_DEPTH - 1; n_leaves > n_colors && 0 <= l; l--) {
+        for (n = 0, idx = 0; (1 << (3 * l)) > idx; idx++) {
+	    if (NODE_INNER == t->level[l][idx].state) {
+	        rec[n].count = t->level[l][idx].count;
+		rec[n].level = l;
+		rec[n].idx = idx;
+		n++;
+	    }
+	}
+	qsort (rec, n, sizeof (rec[0]), by_count_up);
+	for (i = 0; n > i && n_leaves > n_colors; i++) {
+	    for (merged = 0, c = 0; 8 > c; c++) {
+	        up = &t->level[l + 1][child_index (l, rec[i].idx, c)];
+		if (NODE_LEAF == up->state) {
+		    up->state = NODE_MERGED;
+		    merged++;
+		}
+	    }
+	    t->level[l][rec[i].idx].state = NODE_LEAF;
+	    n_leaves -= merged - 1;
+	}
+    }
+
+    /* Number the leaves and average their colors. */
+    for (n = 0, l = 0; OCTREE_DEPTH >= l; l++) {
+        for (idx = 0; (1 << (3 * l)) > idx; idx++) {
+	    if (NODE_LEAF == t->level[l][idx].state) {
+	        rec[n].count = t->level[l][idx].count;
+		rec[n].level = l;
+		rec[n].idx = idx;
+		n++;
+	    }
+	}
+    }
+    qsort (rec, n, sizeof (rec[0]), by_count_down);
+    for (i = 0; n > i; i++) {
+        node = &t->level[rec[i].level][rec[i].idx];
+	node->index = i;
+	for (c = 0; 3 > c; c++) {
+	    t->color[i][c] = (node->sum[c] + node->count / 2) / node->count;
+	}
+    }
+    free (rec);
+
+    t->n_colors = n;
+    return n;
+}
+
+
+/*
+ * octree_palette
+ *   DESCRIPTION: Copy the palette produced by octree_reduce.
+ *   INPUTS: t -- the quantizer
+ *           n_colors -- number of palette entries to write
+ *   OUTPUTS: palette -- 6-bit RGB palette colors; entries with no
+ *                       corresponding leaf are set to black
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+octree_palette (const octree_t* t, uint8_t palette[][3], int32_t n_colors)
+{
+    int32_t i; /* index over palette entries */
+
+    for (i = 0; n_colors > i; i++) {
+        if (t->n_colors > i) {
+	    palette[i][0] = t->color[i][0];
+	    palette[i][1] = t->color[i][1];
+	    palette[i][2] = t->color[i][2];
+	} else {
+	    palette[i][0] = palette[i][1] = palette[i][2] = 0;
+	}
+    }
+}
+
+
+/*
+ * octree_lookup
+ *   DESCRIPTION: Find the palette index of a pixel by walking down the
+ *                tree to the leaf that holds it.
+ *   INPUTS: t -- the quantizer (after octree_reduce)
+ *           pixel -- 5:6:5 RGB pixel
+ *   OUTPUTS: none
+ *   RETURN VALUE: palette index of pixel, or 0 if no leaf covers it
+ *   SIDE EFFECTS: none
+ */
+uint8_t
+octree_lookup (const octree_t* t, uint16_t pixel)
+{
+    int32_t key = OCTREE_KEY (pixel); /* index at deepest level */
+    int32_t l;                        /* index over levels      */
+    int32_t s;                        /* bits dropped per color */
+    const octree_node_t* node;        /* node at level l        */
+
+    for (l = 0; OCTREE_DEPTH >= l; l++) {
+        s = OCTREE_DEPTH - l;
+	node = &t->level[l][((key >> (2 * OCTREE_DEPTH + s)) << (2 * l)) |
+			    (((key >> (OCTREE_DEPTH + s)) & ((1 << l) - 1))
+			    	<< l) |
+			    ((key >> s) & ((1 << l) - 1))];
+	if (NODE_LEAF == node->state) {
+	    return node->index;
+	}
+    }
+    return 0;
+}
+
+
+/*
+ * octree_build_lut
+ *   DESCRIPTION: Fill a table with the palette index (plus an offset) of
+ *                every 5:5:5 pixel index.  Indices that were never
+ *                counted map to the leaf covering them, if any, or to
+ *                palette index 0.
+ *   INPUTS: t -- the quantizer (after octree_reduce)
+ *           base -- offset added to each palette index
+ *   OUTPUTS: lut -- table indexed by OCTREE_KEY (pixel)
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+octree_build_lut (const octree_t* t, uint8_t base,
+		  uint8_t lut[OCTREE_LUT_SIZE])
+{
+    int32_t key; /* index over deepest level */
+
+    /*
+     * OCTREE_KEY drops the low bit of green, which is exactly the part of
+     * a 5:6:5 pixel that does not affect the path through the tree.
+     */
+    for (key = 0; OCTREE_LUT_SIZE > key; key++) {
+        lut[key] = base + octree_lookup (t, ((key & 0x7FE0) << 1) |
+					    (key & 0x001F));
+    }
+}
+
+
+#if defined(OCTREE_BENCHMARK)
+
+#include <stdio.h>
+#include <time.h>
+
+#include "photo_headers.h"
+
+/*
+ * The code below builds a standalone benchmark for the quantizer.  For
+ * each room photo named on the command line, the photo is quantized
+ * repeatedly to the requested number of colors, and the program reports
+ * the throughput (counting, reducing, building the lookup table, and
+ * mapping every pixel) and the mean squared error per color component
+ * of the quantized photo in 6-bit RGB units.
+ */
+
+#define BENCH_REPS 5	/* quantizations timed for each photo */
+
+
+/*
+ * main -- for the "octbench" program
+ *   DESCRIPTION: Measure quantizer speed and quality on room photos.
+ *   INPUTS: argv[1..] -- "-n <colors>" (default 192), then photo names
+ *   OUTPUTS: prints one line of results per photo and a summary
+ *   RETURN VALUE: 0 on success, 3 on failure
+ */
+int
+main (int argc, char* argv[])
+{
+    static uint8_t  lut[OCTREE_LUT_SIZE]; /* pixel key to palette index */
+    struct timespec start, end;	/* clock readings                  */
+    photo_header_t hdr;		/* photo file header               */
+    FILE*     in;		/* photo file                      */
+    uint16_t* pixels;		/* 5:6:5 pixels of photo           */
+    uint8_t*  mapped;		/* palette index of each pixel     */
+    octree_t* t = NULL;		/* quantizer                       */
+    int32_t   n_colors = 192;	/* palette size                    */
+    int32_t   n_used = 0;	/* palette colors produced         */
+    int32_t   first = 1;	/* first file name argument        */
+    int32_t   f;		/* index over files                */
+    int32_t   rep;		/* index over repetitions          */
+    int32_t   c;		/* index over color components     */
+    int32_t   v[3];		/* 6-bit color of one pixel        */
+    size_t    n;		/* number of pixels in photo       */
+    size_t    i;		/* index over pixels               */
+    double    ms;		/* time per quantization in ms     */
+    double    err;		/* squared error summed over photo */
+    double    tot_px = 0.0;	/* pixels over all photos          */
+    double    tot_ms = 0.0;	/* time over all photos            */
+    double    tot_err = 0.0;	/* squared error over all photos   */
+
+    if (2 < argc && 0 == strcmp (argv[1], "-n")) {
+        n_colors = atoi (argv[2]);
+	first = 3;
+    }
+
+    for (f = first; argc > f; f++) {
+        if (NULL == (in = fopen (argv[f], "rb")) ||
+	    1 != fread (&hdr, sizeof (hdr), 1, in) ||
+	    0 == (n = hdr.width * hdr.height) ||
+	    NULL == (pixels = malloc (n * sizeof (pixels[0]))) ||
+	    NULL == (mapped = malloc (n)) ||
+	    n != fread (pixels, sizeof (pixels[0]), n, in)) {
+	    fprintf (stderr, "Can't read room photo %s.\n", argv[f]);
+	    return 3;
+	}
+	(void)fclose (in);
+
+	(void)clock_gettime (CLOCK_MONOTONIC, &start);
+	for (rep = 0; BENCH_REPS > rep; rep++) {
+	    if (NULL != t) {
+	        octree_destroy (t);
+	    }
+	    if (NULL == (t = octree_create ())) {
+	        fputs ("out of memory\n", stderr);
+		return 3;
+	    }
+	    for (i = 0; n > i; i++) {
+	        octree_add_pixel (t, pixels[i]);
+	    }
+	    n_used = octree_reduce (t, n_colors);
+	    octree_build_lut (t, 0, lut);
+	    for (i = 0; n > i; i++) {
+	        mapped[i] = lut[OCTREE_KEY (pixels[i])];
+	    }
+	}
+	(void)clock_gettime (CLOCK_MONOTONIC, &end);
+	ms = ((end.tv_sec - start.tv_sec) * 1000.0 +
+	      (end.tv_nsec - start.tv_nsec) / 1000000.0) / BENCH_REPS;
+
+	for (err = 0.0, i = 0; n > i; i++) {
+	    v[0] = ((pixels[i] >> 10) & 0x3E) | (pixels[i] >> 15);
+	    v[1] = (pixels[i] >> 5) & 0x3F;
+	    v[2] = ((pixels[i] << 1) & 0x3E) | ((pixels[i] >> 4) & 1);
+	    for (c = 0; 3 > c; c++) {
+	        err += (double)(v[c] - t->color[mapped[i]][c]) *
+		       (v[c] - t->color[mapped[i]][c]);
+	    }
+	}
+	printf ("%-32s %4dx%-4d %3d colors  %7.3f ms  %6.1f Mpx/s  "
+		"MSE %7.4f\n", argv[f], hdr.width, hdr.height, n_used, ms,
+		n / ms / 1000.0, err / (3.0 * n));
+	tot_px += n;
+	tot_ms += ms;
+	tot_err += err;
+
+	free (pixels);
+	free (mapped);
+    }
+    if (0.0 < tot_ms) {
+	printf ("total: %.0f pixels  %.3f ms  %.1f Mpx/s  MSE %.4f\n",
+		tot_px, tot_ms, tot_px / tot_ms / 1000.0,
+		tot_err / (3.0 * tot_px));
+    }
+    if (NULL != t) {
+        octree_destroy (t);
+    }
+
+    return 0;
+}
+
+#endif /* defined(OCTREE_BENCHMARK) */
@@ -0,0 +1,72 @@
+/*									tab:8
+ *
+ * octree.h - octree color quantizer header file
+ *
+ * The quantizer builds an octree over 5:6:5 RGB pixels (using five bits
+ * of each color component, so the deepest of the five levels below the
+ * root has 32768 nodes), merges nodes from the bottom up until no more
+ * than the requested number of leaves remain, and turns each leaf into
+ * one palette color.  Colors are exact averages of all pixels under the
+ * leaf, rounded once at the end.  Merging order and palette order are
+ * fully determined by pixel counts and node positions, so the same
+ * pixels always give the same palette.
+ */
+#ifndef OCTREE_H
+#define OCTREE_H
+
+
+#include <stdint.h>
+
+
+/* number of levels below the root of the tree */
+#define OCTREE_DEPTH     5
+
+/* largest palette that a quantizer can produce */
+#define OCTREE_MAX_COLORS 256
+
+/*
+ * Pixels are looked up by their index in the deepest level of the tree,
+ * which keeps the five most significant bits of each of red, green, and
+ * blue (5:5:5).  OCTREE_LUT_SIZE is the number of such indices.
+ */
+#define OCTREE_LUT_SIZE  (1 << (3 * OCTREE_DEPTH))
+#define OCTREE_KEY(pixel) ((((pixel) >> 1) & 0x7FE0) | ((pixel) & 0x001F))
+
+
+typedef struct octree_t octree_t;
+
+/* Create an empty quantizer.  Returns NULL if out of memory. */
+extern octree_t* octree_create (void);
+
+/* Release a quantizer and all of its memory. */
+extern void octree_destroy (octree_t* t);
+
+/* Count one 5:6:5 pixel toward the palette. */
+extern void octree_add_pixel (octree_t* t, uint16_t pixel);
+
+/*
+ * Merge nodes until at most n_colors leaves remain and number the
+ * leaves.  Returns the number of palette colors produced.  Pixels
+ * should not be added after calling this function.
+ */
+extern int32_t octree_reduce (octree_t* t, int32_t n_colors);
+
+/*
+ * Write the palette as 6-bit RGB values.  Entries beyond the number of
+ * colors returned by octree_reduce (up to n_colors) are set to black.
+ */
+extern void octree_palette (const octree_t* t, uint8_t palette[][3],
+			    int32_t n_colors);
+
+/* Find the palette index of a pixel by walking down the tree. */
+extern uint8_t octree_lookup (const octree_t* t, uint16_t pixel);
+
+/*
+ * Fill a table with base plus the palette index of every 5:5:5 pixel
+ * index (see OCTREE_KEY).  Indices that were never counted map to the
+ * leaf covering them, if any, or to base.
+ */
+extern void octree_build_lut (const octree_t* t, uint8_t base,
+			      uint8_t lut[OCTREE_LUT_SIZE]);
+
+#endif /* OCTREE_H */
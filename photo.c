@@ -36,15 +36,51 @@
  */
 
 
+#include <fcntl.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #include "assert.h"
 #include "modex.h"
+#include "octree.h"
 #include "photo.h"
 #include "photo_headers.h"
 #include "world.h"
 
-#define OCTREE_4_LEVEL 4096
+/* 
+ * number of VGA palette colors available to a room photo; the other 64
+ * are used for the object images
+ */
+#define PHOTO_COLORS 192
+
+/* 
+ * Decoded room photos are cached next to their source files (with 
+ * PHOTO_CACHE_SUFFIX appended to the name) so that later runs can map
+ * the palette and pixels into memory instead of quantizing again.  A
+ * cache file holds a photo_cache_header_t followed by the palette-indexed
+ * pixels, top row first.  Caches are ignored unless the source file's
+ * size and modification time match those recorded in the header.
+ * PHOTO_CACHE_VERSION must be changed whenever read_photo would produce
+ * different output from the same source file.
+ */
+#define PHOTO_CACHE_SUFFIX  ".cache"
+#define PHOTO_CACHE_MAGIC   0x48435032	/* "2PCH" on little-endian */
+#define PHOTO_CACHE_VERSION 1
+
+/* 
+ * default largest photo (in bytes) that fill_vert_buffer copies by 
+ * column; see photo_set_col_budget
+ */
+#define PHOTO_COL_BUDGET (MAX_PHOTO_WIDTH * MAX_PHOTO_HEIGHT)
+
+/* width and height of the blocks of pixels moved when copying by column */
+#define PHOTO_COL_BLOCK 32
 
 
 /* types local to this file (declared in types.h) */
@@ -55,12 +91,26 @@
  * well as the code that sets up the VGA to make use of these colors.
  * Pixel data are stored as one-byte values starting from the upper
  * left and traversing the top row before returning to the left of
- * the second row, and so forth.  No padding should be used.
+ * the second row, and so forth.  No padding should be used.  A photo
+ * loaded from a cache file keeps its pixel data in a read-only mapping
+ * of that file; otherwise, map is NULL and img is dynamically allocated.
+ * Each photo read gets a different serial number, which identifies the
+ * photo held in the column copy used by fill_vert_buffer.
  */
 struct photo_t {
-    photo_header_t hdr;			/* defines height and width */
-    uint8_t        palette[192][3];     /* optimized palette colors */
-    uint8_t*       img;                 /* pixel data               */
+    photo_header_t hdr;                      /* defines height and width */
+    uint8_t        palette[PHOTO_COLORS][3]; /* optimized palette colors */
+    uint8_t*       img;                      /* pixel data               */
+    void*          map;                      /* cache mapping, or NULL   */
+    size_t         map_len;                  /* length of cache mapping  */
+    uint32_t       serial;                   /* unique photo number      */
+};
+
+/* a run of opaque pixels in a row or column of an object image */
+typedef struct image_span_t image_span_t;
+struct image_span_t {
+    uint8_t start;	/* offset of first pixel in row or column */
+    uint8_t len;	/* number of pixels                       */
 };
 
 /* 
@@ -71,13 +121,60 @@ struct photo_t {
  * pixel data are stored as one-byte values starting from the upper 
  * left and traversing the top row before returning to the left of the 
  * second row, and so forth.  No padding is used.
+ *
+ * So that objects can be drawn without testing each pixel, the image
+ * also records its runs of opaque pixels: row_first[y] is the index in
+ * spans of the first run in row y, and the runs of row y end where those
+ * of row y + 1 begin (row_first has height + 1 entries).  The columns 
+ * are recorded in the same way in col_first, with runs that index into 
+ * cols, a copy of the pixel data stored column by column (left column 
+ * first, each from top to bottom).
  */
 struct image_t {
     photo_header_t hdr;			/* defines height and width */
     uint8_t*       img;                 /* pixel data               */
+    uint8_t*       cols;                /* pixel data by column     */
+    uint16_t*      row_first;           /* first span of each row   */
+    uint16_t*      col_first;           /* first span of each col   */
+    image_span_t*  spans;               /* opaque runs of pixels    */
+};
+
+
+/* header of a room photo cache file */
+typedef struct photo_cache_header_t photo_cache_header_t;
+struct photo_cache_header_t {
+    uint32_t       magic;                    /* PHOTO_CACHE_MAGIC        */
+    uint32_t       version;                  /* PHOTO_CACHE_VERSION      */
+    uint64_t       src_size;                 /* source file size (bytes) */
+    int64_t        src_sec;                  /* source file modification */
+    int64_t        src_nsec;                 /*   time                   */
+    photo_header_t hdr;                      /* defines height and width */
+    uint8_t        palette[PHOTO_COLORS][3]; /* optimized palette colors */
 };
 
 
+/* local functions--see function headers for details */
+static void blit_masked_c (uint8_t* dst, const uint8_t* src, int32_t n);
+#if defined(__i386__) || defined(__x86_64__)
+static void blit_masked_avx2 (uint8_t* dst, const uint8_t* src, int32_t n);
+static void blit_masked_sse2 (uint8_t* dst, const uint8_t* src, int32_t n);
+#endif
+static void copy_obj_col (const image_t* img, int32_t col, int32_t dy,
+			  unsigned char buf[SCROLL_Y_DIM]);
+static void copy_obj_row (const image_t* img, int32_t row, int32_t dx,
+			  unsigned char buf[SCROLL_X_DIM]);
+static void fill_photo_col (const photo_t* view, int x, int y,
+			    unsigned char buf[SCROLL_Y_DIM]);
+static int32_t find_spans (const uint8_t* pix, int32_t n, int32_t stride,
+			   image_span_t* spans);
+static int32_t index_spans (image_t* img);
+static void select_blit_masked (uint8_t* dst, const uint8_t* src, 
+				int32_t n);
+static photo_t* load_photo_cache (const char* cname, const struct stat* src);
+static const uint8_t* photo_cols (const photo_t* p);
+static void write_photo_cache (const char* cname, const struct stat* src,
+			       const photo_t* p);
+
 
 /* file-scope variables */
 
@@ -89,21 +186,200 @@ struct image_t {
  */
 static const room_t* cur_room = NULL; 
 
+/* Are room photo caches read and written?  (See photo_set_cache.) */
+static int32_t use_cache = 1;
 
-/**
- * 
- * 
+/* serial number of the last photo read (see struct photo_t) */
+static uint32_t last_serial = 0;
+
+/* 
+ * A copy of the pixels of the photo being scrolled, stored column by 
+ * column (left column first, each from top to bottom), so that vertical
+ * lines can be filled from consecutive bytes.  The copy is made by 
+ * photo_cols when the first vertical line of a photo is drawn, but only
+ * for photos no larger than col_budget bytes.  Only the thread drawing
+ * the screen uses these variables.
+ */
+static uint8_t* col_copy = NULL;	  /* the copy, or NULL         */
+static size_t   col_copy_size = 0;	  /* bytes allocated for copy  */
+static uint32_t col_copy_serial = 0;	  /* photo copied (0 for none) */
+static uint32_t col_budget = PHOTO_COL_BUDGET; /* largest photo copied */
+
+/* 
+ * Copies the opaque pixels of an object image line over a line buffer.
+ * The first call picks the fastest version supported by the processor.
+ */
+static void (*blit_masked) (uint8_t* dst, const uint8_t* src, int32_t n) =
+	select_blit_masked;
+
+
+/* 
+ * blit_masked_c
+ *   DESCRIPTION: Copy the opaque pixels of part of an object image line
+ *                over part of a line buffer, one pixel at a time.
+ *   INPUTS: src -- first object image pixel
+ *           n -- number of pixels
+ *   OUTPUTS: dst -- first line buffer pixel
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+blit_masked_c (uint8_t* dst, const uint8_t* src, int32_t n)
+{
+    int32_t i;	/* index over pixels */
+
+    for (i = 0; n > i; i++) {
+	if (OBJ_CLR_TRANSP != src[i]) {
+	    dst[i] = src[i];
+	}
+    }
+}
+
+
+#if defined(__i386__) || defined(__x86_64__)
+
+/* 
+ * blit_masked_avx2
+ *   DESCRIPTION: Copy the opaque pixels of part of an object image line
+ *                over part of a line buffer, 32 pixels at a time.
+ *                Requires AVX2.
+ *   INPUTS: src -- first object image pixel
+ *           n -- number of pixels
+ *   OUTPUTS: dst -- first line buffer pixel
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+__attribute__ ((target ("avx2"))) static void
+blit_masked_avx2 (uint8_t* dst, const uint8_t* src, int32_t n)
+{
+    __m256i transp = _mm256_set1_epi8 (OBJ_CLR_TRANSP); /* for compare */
+    __m256i s;	/* object image pixels            */
+    __m256i d;	/* line buffer pixels             */
+    int32_t i;	/* index over pixels              */
+
+    for (i = 0; n - 32 >= i; i += 32) {
+	s = _mm256_loadu_si256 ((const __m256i*)&src[i]);
+	d = _mm256_loadu_si256 ((const __m256i*)&dst[i]);
+	d = _mm256_blendv_epi8 (s, d, _mm256_cmpeq_epi8 (s, transp));
+	_mm256_storeu_si256 ((__m256i*)&dst[i], d);
+    }
+    blit_masked_c (&dst[i], &src[i], n - i);
+}
+
+
+/* 
+ * blit_masked_sse2
+ *   DESCRIPTION: Copy the opaque pixels of part of an object image line
+ *                over part of a line buffer, 16 pixels at a time.
+ *                Requires SSE2.
+ *   INPUTS: src -- first object image pixel
+ *           n -- number of pixels
+ *   OUTPUTS: dst -- first line buffer pixel
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
  */
+__attribute__ ((target ("sse2"))) static void
+blit_masked_sse2 (uint8_t* dst, const uint8_t* src, int32_t n)
+{
+    __m128i transp = _mm_set1_epi8 (OBJ_CLR_TRANSP); /* for compare    */
+    __m128i s;	/* object image pixels            */
+    __m128i d;	/* line buffer pixels             */
+    __m128i eq;	/* all ones for transparent pixel */
+    int32_t i;	/* index over pixels              */
+
+    for (i = 0; n - 16 >= i; i += 16) {
+	s = _mm_loadu_si128 ((const __m128i*)&src[i]);
+	d = _mm_loadu_si128 ((const __m128i*)&dst[i]);
+	eq = _mm_cmpeq_epi8 (s, transp);
+	d = _mm_or_si128 (_mm_and_si128 (eq, d), _mm_andnot_si128 (eq, s));
+	_mm_storeu_si128 ((__m128i*)&dst[i], d);
+    }
+    blit_masked_c (&dst[i], &src[i], n - i);
+}
+
+#endif /* defined(__i386__) || defined(__x86_64__) */
 
-typedef struct _colors_t
+
+/* 
+ * copy_obj_row
+ *   DESCRIPTION: Copy the opaque pixels of one row of an object image 
+ *                into a horizontal line buffer, clipped to the buffer.
+ *                A row with a single run of opaque pixels is copied 
+ *                directly; the part of any other row between its first 
+ *                and last opaque pixels is copied with blit_masked.
+ *   INPUTS: img -- the object image
+ *           row -- row of the image to copy
+ *           dx -- buffer position of the image's left column (may be
+ *                 negative or beyond the buffer)
+ *   OUTPUTS: buf -- line buffer
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+copy_obj_row (const image_t* img, int32_t row, int32_t dx,
+	      unsigned char buf[SCROLL_X_DIM])
 {
-	/* data */
-	unsigned int count;
-	unsigned int avgR;
-	unsigned int avgG; 
-	unsigned int avgB;
+    const uint8_t*      pix = &img->img[img->hdr.width * row];
+    const image_span_t* sp;	/* index over runs in row    */
+    const image_span_t* end;	/* end of runs in row        */
+    int32_t             lo;	/* first image column copied */
+    int32_t             hi;	/* image column after copy   */
+
+    sp = &img->spans[img->row_first[row]];
+    end = &img->spans[img->row_first[row + 1]];
+    if (end == sp) {
+        return;
+    }
+    lo = (0 > dx + sp->start ? -dx : sp->start);
+    hi = end[-1].start + end[-1].len;
+    if (SCROLL_X_DIM < dx + hi) {
+        hi = SCROLL_X_DIM - dx;
+    }
+    if (lo >= hi) {
+        return;
+    }
+    if (end == sp + 1) {
+	(void)memcpy (&buf[dx + lo], &pix[lo], hi - lo);
+    } else {
+	(*blit_masked) (&buf[dx + lo], &pix[lo], hi - lo);
+    }
+}
+
+
+/* 
+ * copy_obj_col
+ *   DESCRIPTION: Copy the opaque pixels of one column of an object image
+ *                into a vertical line buffer, one run at a time, 
+ *                clipping the runs to the buffer.
+ *   INPUTS: img -- the object image
+ *           col -- column of the image to copy
+ *           dy -- buffer position of the image's top row (may be 
+ *                 negative or beyond the buffer)
+ *   OUTPUTS: buf -- line buffer
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+copy_obj_col (const image_t* img, int32_t col, int32_t dy,
+	      unsigned char buf[SCROLL_Y_DIM])
+{
+    const uint8_t*      pix = &img->cols[img->hdr.height * col];
+    const image_span_t* sp;	/* index over runs in column */
+    const image_span_t* end;	/* end of runs in column     */
+    int32_t             lo;	/* first image row copied    */
+    int32_t             hi;	/* image row after copy      */
+
+    end = &img->spans[img->col_first[col + 1]];
+    for (sp = &img->spans[img->col_first[col]]; end > sp; sp++) {
+	lo = (0 > dy + sp->start ? -dy : sp->start);
+	hi = (SCROLL_Y_DIM < dy + sp->start + sp->len ? SCROLL_Y_DIM - dy :
+	      sp->start + sp->len);
+	if (lo < hi) {
+	    (void)memcpy (&buf[dy + lo], &pix[lo], hi - lo);
+	}
+    }
+}
 
-} colors_t;
 
 /* 
  * fill_horiz_buffer
@@ -124,14 +400,14 @@ void
 fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
 {
     int            idx;   /* loop index over pixels in the line          */ 
-    object_t*      obj;   /* loop index over objects in the current room */
-    int            imgx;  /* loop index over pixels in object image      */ 
-    int            yoff;  /* y offset into object image                  */ 
-    uint8_t        pixel; /* pixel from object image                     */
+    object_t*      obj;   /* object that may overlap the line            */
     const photo_t* view;  /* room photo                                  */
     int32_t        obj_x; /* object x position                           */
     int32_t        obj_y; /* object y position                           */
     const image_t* img;   /* object image                                */
+    object_t*      objs[MAX_ROOM_OBJECTS]; /* objects that may overlap   */
+    int32_t        found; /* number of objects that may overlap line     */
+    int32_t        i;     /* loop index over objects                     */
 
     /* Get pointer to current photo of current room. */
     view = room_photo (cur_room);
@@ -142,9 +418,14 @@ fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
 		    view->img[view->hdr.width * y + x + idx] : 0);
     }
 
-    /* Loop over objects in the current room. */
-    for (obj = room_contents_iterate (cur_room); NULL != obj;
-    	 obj = obj_next (obj)) {
+    /* 
+     * Loop over the objects in the current room that the room's index 
+     * finds in the line's band of rows, in the order of the room's 
+     * contents.
+     */
+    found = room_objects_on_row (cur_room, y, objs);
+    for (i = 0; found > i; i++) {
+	obj = objs[i];
 	obj_x = obj_get_x (obj);
 	obj_y = obj_get_y (obj);
 	img = obj_image (obj);
@@ -155,29 +436,91 @@ fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
 	    continue;
 	}
 
-	/* The y offset of drawing is fixed. */
-	yoff = (y - obj_y) * img->hdr.width;
+	/* Copy the object's opaque pixels. */
+	copy_obj_row (img, y - obj_y, obj_x - x, buf);
+    }
+}
+
+
+/* 
+ * fill_horiz_block
+ *   DESCRIPTION: Given the (x,y) map pixel coordinate of the leftmost 
+ *                pixel of the first of several adjacent horizontal lines
+ *                to be drawn on the screen, this routine produces an 
+ *                image of each line.  The result is the same as that of 
+ *                fill_horiz_buffer for each line, but the photo is 
+ *                clipped and the room's objects are found and clipped 
+ *                only once for all of the lines.
+ *   INPUTS: (x,y) -- leftmost pixel of first line to be drawn 
+ *           height -- number of lines (at most MAX_BLOCK_HEIGHT)
+ *   OUTPUTS: buf -- buffer holding image data for the lines
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+fill_horiz_block (int x, int y, int height, 
+		  unsigned char buf[MAX_BLOCK_HEIGHT][SCROLL_X_DIM])
+{
+    object_t*      obj;   /* object that may overlap the lines           */
+    const photo_t* view;  /* room photo                                  */
+    int32_t        obj_x; /* object x position                           */
+    int32_t        obj_y; /* object y position                           */
+    const image_t* img;   /* object image                                */
+    object_t*      objs[MAX_ROOM_OBJECTS]; /* objects that may overlap   */
+    int32_t        found; /* number of objects that may overlap lines    */
+    int32_t        i;     /* loop index over objects                     */
+    int32_t        j;     /* loop index over lines                       */
+    int32_t        lo;    /* first line pixel (or line) inside photo     */
+    int32_t        hi;    /* pixel (or line) after last inside photo     */
+
+    /* Get pointer to current photo of current room. */
+    view = room_photo (cur_room);
 
-	/* 
-	 * The x offsets depend on whether the object starts to the left
-	 * or to the right of the starting point for the line being drawn.
-	 */
-	if (x <= obj_x) {
-	    idx = obj_x - x;
-	    imgx = 0;
-	} else {
-	    idx = 0;
-	    imgx = x - obj_x;
+    /* Clip the lines to the photo's columns, then copy each line. */
+    lo = (0 > x ? -x : 0);
+    hi = (view->hdr.width < x + SCROLL_X_DIM ? view->hdr.width - x :
+	  SCROLL_X_DIM);
+    if (SCROLL_X_DIM < lo) {
+        lo = SCROLL_X_DIM;
+    }
+    if (lo > hi) {
+        hi = lo;
+    }
+    for (j = 0; height > j; j++) {
+	if (0 > y + j || view->hdr.height <= y + j) {
+	    (void)memset (buf[j], 0, SCROLL_X_DIM);
+	    continue;
 	}
+	(void)memset (buf[j], 0, lo);
+	(void)memcpy (&buf[j][lo], 
+		      &view->img[view->hdr.width * (y + j) + x + lo], hi - lo);
+	(void)memset (&buf[j][hi], 0, SCROLL_X_DIM - hi);
+    }
+
+    /* 
+     * Loop over the objects in the current room that the room's index 
+     * finds in the lines' bands of rows, in the order of the room's 
+     * contents.
+     */
+    found = room_objects_in_rows (cur_room, y, height, objs);
+    for (i = 0; found > i; i++) {
+	obj = objs[i];
+	obj_x = obj_get_x (obj);
+	obj_y = obj_get_y (obj);
+	img = obj_image (obj);
 
-	/* Copy the object's pixel data. */
-	for (; SCROLL_X_DIM > idx && img->hdr.width > imgx; idx++, imgx++) {
-	    pixel = img->img[yoff + imgx];
+        /* Is object outside of the lines we're drawing? */
+	if (y + height <= obj_y || y >= obj_y + img->hdr.height ||
+	    x + SCROLL_X_DIM <= obj_x || x >= obj_x + img->hdr.width) {
+	    continue;
+	}
 
-	    /* Don't copy transparent pixels. */
-	    if (OBJ_CLR_TRANSP != pixel) {
-		buf[idx] = pixel;
-	    }
+	/* Copy the object's opaque pixels in each line that it covers. */
+	lo = (y > obj_y ? y : obj_y) - y;
+	hi = (y + height < obj_y + img->hdr.height ? 
+	      y + height : obj_y + img->hdr.height) - y;
+	for (j = lo; hi > j; j++) {
+	    copy_obj_row (img, y + j - obj_y, obj_x - x, buf[j]);
 	}
     }
 }
@@ -196,33 +539,34 @@ fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
  *   INPUTS: (x,y) -- top pixel of line to be drawn 
  *   OUTPUTS: buf -- buffer holding image data for the line
  *   RETURN VALUE: none
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: may copy the room photo by column (see photo_cols)
  */
 void
 fill_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM])
 {
-    int            idx;   /* loop index over pixels in the line          */ 
-    object_t*      obj;   /* loop index over objects in the current room */
-    int            imgy;  /* loop index over pixels in object image      */ 
-    int            xoff;  /* x offset into object image                  */ 
-    uint8_t        pixel; /* pixel from object image                     */
+    object_t*      obj;   /* object that may overlap the line            */
     const photo_t* view;  /* room photo                                  */
     int32_t        obj_x; /* object x position                           */
     int32_t        obj_y; /* object y position                           */
     const image_t* img;   /* object image                                */
+    object_t*      objs[MAX_ROOM_OBJECTS]; /* objects that may overlap   */
+    int32_t        found; /* number of objects that may overlap line     */
+    int32_t        i;     /* loop index over objects                     */
 
     /* Get pointer to current photo of current room. */
     view = room_photo (cur_room);
 
-    /* Loop over pixels in line. */
-    for (idx = 0; idx < SCROLL_Y_DIM; idx++) {
-        buf[idx] = (0 <= y + idx && view->hdr.height > y + idx ?
-		    view->img[view->hdr.width * (y + idx) + x] : 0);
-    }
+    /* Copy the photo's pixels in the line. */
+    fill_photo_col (view, x, y, buf);
 
-    /* Loop over objects in the current room. */
-    for (obj = room_contents_iterate (cur_room); NULL != obj;
-    	 obj = obj_next (obj)) {
+    /* 
+     * Loop over the objects in the current room that the room's index 
+     * finds in the line's band of columns, in the order of the room's 
+     * contents.
+     */
+    found = room_objects_on_col (cur_room, x, objs);
+    for (i = 0; found > i; i++) {
+	obj = objs[i];
 	obj_x = obj_get_x (obj);
 	obj_y = obj_get_y (obj);
 	img = obj_image (obj);
@@ -233,31 +577,121 @@ fill_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM])
 	    continue;
 	}
 
-	/* The x offset of drawing is fixed. */
-	xoff = x - obj_x;
+	/* Copy the object's opaque pixels. */
+	copy_obj_col (img, x - obj_x, obj_y - y, buf);
+    }
+}
+
 
-	/* 
-	 * The y offsets depend on whether the object starts below or 
-	 * above the starting point for the line being drawn.
-	 */
-	if (y <= obj_y) {
-	    idx = obj_y - y;
-	    imgy = 0;
-	} else {
-	    idx = 0;
-	    imgy = y - obj_y;
+/* 
+ * fill_vert_strip
+ *   DESCRIPTION: Given the (x,y) map pixel coordinate of the top pixel of 
+ *                the first of several adjacent vertical lines to be drawn
+ *                on the screen, this routine produces an image of each
+ *                line.  The result is the same as that of fill_vert_buffer
+ *                for each line, but the room's objects are found and 
+ *                clipped only once for all of the lines.
+ *   INPUTS: (x,y) -- top pixel of first line to be drawn 
+ *           width -- number of lines (at most MAX_STRIP_WIDTH)
+ *   OUTPUTS: buf -- buffer holding image data for the lines, one line 
+ *                   per row
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may copy the room photo by column (see photo_cols)
+ */
+void
+fill_vert_strip (int x, int y, int width, 
+		 unsigned char buf[MAX_STRIP_WIDTH][SCROLL_Y_DIM])
+{
+    object_t*      obj;   /* object that may overlap the lines           */
+    const photo_t* view;  /* room photo                                  */
+    int32_t        obj_x; /* object x position                           */
+    int32_t        obj_y; /* object y position                           */
+    const image_t* img;   /* object image                                */
+    object_t*      objs[MAX_ROOM_OBJECTS]; /* objects that may overlap   */
+    int32_t        found; /* number of objects that may overlap lines    */
+    int32_t        i;     /* loop index over objects                     */
+    int32_t        j;     /* loop index over lines                       */
+    int32_t        lo;    /* first line covered by object                */
+    int32_t        hi;    /* line after last covered by object           */
+
+    /* Get pointer to current photo of current room. */
+    view = room_photo (cur_room);
+
+    /* Copy the photo's pixels in each line. */
+    for (j = 0; width > j; j++) {
+	fill_photo_col (view, x + j, y, buf[j]);
+    }
+
+    /* 
+     * Loop over the objects in the current room that the room's index 
+     * finds in the lines' bands of columns, in the order of the room's 
+     * contents.
+     */
+    found = room_objects_in_cols (cur_room, x, width, objs);
+    for (i = 0; found > i; i++) {
+	obj = objs[i];
+	obj_x = obj_get_x (obj);
+	obj_y = obj_get_y (obj);
+	img = obj_image (obj);
+
+        /* Is object outside of the lines we're drawing? */
+	if (x + width <= obj_x || x >= obj_x + img->hdr.width ||
+	    y + SCROLL_Y_DIM <= obj_y || y >= obj_y + img->hdr.height) {
+	    continue;
+	}
+
+	/* Copy the object's opaque pixels in each line that it covers. */
+	lo = (x > obj_x ? x : obj_x) - x;
+	hi = (x + width < obj_x + img->hdr.width ? 
+	      x + width : obj_x + img->hdr.width) - x;
+	for (j = lo; hi > j; j++) {
+	    copy_obj_col (img, x + j - obj_x, obj_y - y, buf[j]);
 	}
+    }
+}
 
-	/* Copy the object's pixel data. */
-	for (; SCROLL_Y_DIM > idx && img->hdr.height > imgy; idx++, imgy++) {
-	    pixel = img->img[xoff + img->hdr.width * imgy];
 
-	    /* Don't copy transparent pixels. */
-	    if (OBJ_CLR_TRANSP != pixel) {
-		buf[idx] = pixel;
-	    }
+/* 
+ * fill_photo_col
+ *   DESCRIPTION: Copy the part of one column of a room photo that falls
+ *                in a vertical line, using the photo's column copy if 
+ *                it has one.  Pixels outside the photo are set to 0.
+ *   INPUTS: view -- the room photo
+ *           (x,y) -- top pixel of line
+ *   OUTPUTS: buf -- buffer holding image data for the line
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may copy the room photo by column (see photo_cols)
+ */
+static void
+fill_photo_col (const photo_t* view, int x, int y,
+		unsigned char buf[SCROLL_Y_DIM])
+{
+    const uint8_t* cols; /* photo pixels by column, or NULL   */
+    int            idx;  /* loop index over pixels in line    */
+    int            lo;   /* first line pixel inside photo     */
+    int            hi;   /* line pixel after last inside photo */
+
+    if (NULL == (cols = photo_cols (view))) {
+	for (idx = 0; idx < SCROLL_Y_DIM; idx++) {
+	    buf[idx] = (0 <= y + idx && view->hdr.height > y + idx ?
+			view->img[view->hdr.width * (y + idx) + x] : 0);
 	}
+	return;
+    }
+
+    /* Clip the line to the photo, then copy the column. */
+    lo = (0 > y ? -y : 0);
+    hi = (view->hdr.height < y + SCROLL_Y_DIM ? view->hdr.height - y :
+	  SCROLL_Y_DIM);
+    if (SCROLL_Y_DIM < lo) {
+        lo = SCROLL_Y_DIM;
     }
+    if (lo > hi) {
+        hi = lo;
+    }
+    (void)memset (buf, 0, lo);
+    (void)memcpy (&buf[lo], &cols[view->hdr.height * x + y + lo], hi - lo);
+    (void)memset (&buf[hi], 0, SCROLL_Y_DIM - hi);
 }
 
 
@@ -328,7 +762,9 @@ photo_width (const photo_t* p)
  *   INPUTS: r -- pointer to the new room
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: changes recorded cur_room for this file
+ *   SIDE EFFECTS: changes recorded cur_room for this file; sets the 
+ *                 palette; lays out the build buffer (so the room must 
+ *                 be redrawn)
  */
 void
 prep_room (const room_t* r)
@@ -337,6 +773,128 @@ prep_room (const room_t* r)
     cur_room = r;
 	photo_t *room_pic = room_photo(r);
 	fill_entire_palette((unsigned char **)room_pic->palette);
+
+    /* Lay out the build buffer to hold the whole photo if it can. */
+    (void)size_build_buffer (room_pic->hdr.width, room_pic->hdr.height);
+}
+
+
+/* 
+ * find_spans
+ *   DESCRIPTION: Find the runs of opaque pixels in a row or column of an
+ *                object image.
+ *   INPUTS: pix -- first pixel of the row or column
+ *           n -- number of pixels
+ *           stride -- distance between successive pixels in memory
+ *   OUTPUTS: spans -- the runs found (not written if NULL)
+ *   RETURN VALUE: number of runs
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+find_spans (const uint8_t* pix, int32_t n, int32_t stride, 
+	    image_span_t* spans)
+{
+    int32_t i;		/* index over pixels    */
+    int32_t start;	/* first pixel of run   */
+    int32_t count = 0;	/* number of runs found */
+
+    for (i = 0; n > i; ) {
+	/* Skip transparent pixels, then find the end of the run. */
+        while (n > i && OBJ_CLR_TRANSP == pix[i * stride]) {
+	    i++;
+	}
+	if (n <= i) {
+	    break;
+	}
+	for (start = i; n > i && OBJ_CLR_TRANSP != pix[i * stride]; i++) {
+	}
+	if (NULL != spans) {
+	    spans[count].start = start;
+	    spans[count].len = i - start;
+	}
+	count++;
+    }
+    return count;
+}
+
+
+/* 
+ * index_spans
+ *   DESCRIPTION: Record the runs of opaque pixels in each row and each 
+ *                column of an object image, and make the copy of its 
+ *                pixels stored by column (see struct image_t).
+ *   INPUTS: img -- the image, with pixel data filled in
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 on success, or 0 if out of memory
+ *   SIDE EFFECTS: dynamically allocates memory for the runs and copy
+ */
+static int32_t
+index_spans (image_t* img)
+{
+    int32_t w = img->hdr.width;	 /* image width               */
+    int32_t h = img->hdr.height; /* image height              */
+    int32_t x;			 /* index over image columns  */
+    int32_t y;			 /* index over image rows     */
+    int32_t n;			 /* number of runs            */
+
+    for (n = 0, y = 0; h > y; y++) {
+        n += find_spans (&img->img[w * y], w, 1, NULL);
+    }
+    for (x = 0; w > x; x++) {
+        n += find_spans (&img->img[x], h, w, NULL);
+    }
+    img->row_first = malloc ((w + h + 2) * sizeof (img->row_first[0]));
+    img->spans = malloc ((0 < n ? n : 1) * sizeof (img->spans[0]));
+    img->cols = malloc (w * h);
+    if (NULL == img->row_first || NULL == img->spans || NULL == img->cols) {
+        free (img->row_first);
+        free (img->spans);
+        free (img->cols);
+	return 0;
+    }
+    img->col_first = &img->row_first[h + 1];
+
+    for (x = 0; w > x; x++) {
+        for (y = 0; h > y; y++) {
+	    img->cols[h * x + y] = img->img[w * y + x];
+	}
+    }
+    for (n = 0, y = 0; h > y; y++) {
+	img->row_first[y] = n;
+        n += find_spans (&img->img[w * y], w, 1, &img->spans[n]);
+    }
+    img->row_first[h] = n;
+    for (x = 0; w > x; x++) {
+	img->col_first[x] = n;
+        n += find_spans (&img->cols[h * x], h, 1, &img->spans[n]);
+    }
+    img->col_first[w] = n;
+    return 1;
+}
+
+
+/* 
+ * select_blit_masked
+ *   DESCRIPTION: Choose the fastest version of blit_masked supported by
+ *                the processor, then use it to copy pixels.
+ *   INPUTS: src -- first object image pixel
+ *           n -- number of pixels
+ *   OUTPUTS: dst -- first line buffer pixel
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets blit_masked
+ */
+static void
+select_blit_masked (uint8_t* dst, const uint8_t* src, int32_t n)
+{
+    blit_masked = blit_masked_c;
+#if defined(__i386__) || defined(__x86_64__)
+    if (__builtin_cpu_supports ("avx2")) {
+        blit_masked = blit_masked_avx2;
+    } else if (__builtin_cpu_supports ("sse2")) {
+        blit_masked = blit_masked_sse2;
+    }
+#endif
+    (*blit_masked) (dst, src, n);
 }
 
 
@@ -353,16 +911,19 @@ prep_room (const room_t* r)
 image_t*
 read_obj_image (const char* fname)
 {
-    FILE*    in;		/* input file               */
-    image_t* img = NULL;	/* image structure          */
-    uint16_t x;			/* index over image columns */
-    uint16_t y;			/* index over image rows    */
-    uint8_t  pixel;		/* one pixel from the file  */
+    FILE*    in;		/* input file                      */
+    image_t* img = NULL;	/* image structure                 */
+    uint16_t y;			/* index over image rows           */
+    size_t   n_pixels;		/* number of pixels in image       */
+    uint8_t* top;		/* row being swapped from the top  */
+    uint8_t* bottom;		/* row being swapped to the top    */
+    uint8_t  row[MAX_OBJECT_WIDTH]; /* row held during swap        */
 
     /* 
      * Open the file, allocate the structure, read the header, do some
      * sanity checks on it, and allocate space to hold the image pixels.
-     * If anything fails, clean up as necessary and return NULL.
+     * Then read all of the pixel data with a single call.  If anything 
+     * fails, clean up as necessary and return NULL.
      */
     if (NULL == (in = fopen (fname, "r+b")) ||
 	NULL == (img = malloc (sizeof (*img))) ||
@@ -370,8 +931,9 @@ read_obj_image (const char* fname)
 	1 != fread (&img->hdr, sizeof (img->hdr), 1, in) ||
 	MAX_OBJECT_WIDTH < img->hdr.width ||
 	MAX_OBJECT_HEIGHT < img->hdr.height ||
-	NULL == (img->img = malloc 
-		 (img->hdr.width * img->hdr.height * sizeof (img->img[0])))) {
+	0 == (n_pixels = img->hdr.width * img->hdr.height) ||
+	NULL == (img->img = malloc (n_pixels * sizeof (img->img[0]))) ||
+	n_pixels != fread (img->img, sizeof (img->img[0]), n_pixels, in)) {
 	if (NULL != img) {
 	    if (NULL != img->img) {
 	        free (img->img);
@@ -383,291 +945,1001 @@ read_obj_image (const char* fname)
 	}
 	return NULL;
     }
+    (void)fclose (in);
 
     /* 
-     * Loop over rows from bottom to top.  Note that the file is stored
-     * in this order, whereas in memory we store the data in the reverse
-     * order (top to bottom).
+     * The file stores rows from bottom to top, whereas in memory we 
+     * store the data in the reverse order (top to bottom), so swap the
+     * rows end for end.
      */
-    for (y = img->hdr.height; y-- > 0; ) {
-
-	/* Loop over columns from left to right. */
-	for (x = 0; img->hdr.width > x; x++) {
-
-	    /* 
-	     * Try to read one 8-bit pixel.  On failure, clean up and 
-	     * return NULL.
-	     */
-	    if (1 != fread (&pixel, sizeof (pixel), 1, in)) {
-		free (img->img);
-		free (img);
-	        (void)fclose (in);
-		return NULL;
-	    }
+    for (y = 0; img->hdr.height / 2 > y; y++) {
+        top = &img->img[img->hdr.width * y];
+	bottom = &img->img[img->hdr.width * (img->hdr.height - 1 - y)];
+	(void)memcpy (row, top, img->hdr.width);
+	(void)memcpy (top, bottom, img->hdr.width);
+	(void)memcpy (bottom, row, img->hdr.width);
+    }
 
-	    /* Store the pixel in the image data. */
-	    img->img[img->hdr.width * y + x] = pixel;
-	}
+    /* Find the runs of opaque pixels used when drawing the object. */
+    if (!index_spans (img)) {
+        free (img->img);
+	free (img);
+	return NULL;
     }
 
     /* All done.  Return success. */
-    (void)fclose (in);
     return img;
 }
 
 
 
-// 
+/* 
+ * read_photo_size
+ *   DESCRIPTION: Read only the size of a room photo from its file, without
+ *                decoding the photo.  The file must be long enough to
+ *                hold the photo's pixels, so that a truncated photo is
+ *                found now rather than when it is read.
+ *   INPUTS: fname -- file name for input
+ *   OUTPUTS: hdr -- the photo's width and height
+ *   RETURN VALUE: 1 on success, or 0 if the file can't be read, the
+ *                 photo is too large, or the file is too short
+ *   SIDE EFFECTS: none
+ */
+int32_t
+read_photo_size (const char* fname, photo_header_t* hdr)
+{
+    FILE*       in;	/* input file          */
+    struct stat st;	/* input file status   */
+    int32_t     ok;	/* was the size valid? */
+
+    if (NULL == (in = fopen (fname, "rb"))) {
+        return 0;
+    }
+    ok = (1 == fread (hdr, sizeof (*hdr), 1, in) &&
+	  MAX_PHOTO_WIDTH >= hdr->width && MAX_PHOTO_HEIGHT >= hdr->height &&
+	  0 < hdr->width && 0 < hdr->height &&
+	  0 == fstat (fileno (in), &st) &&
+	  sizeof (*hdr) + (size_t)hdr->width * hdr->height *
+	      sizeof (uint16_t) <= (size_t)st.st_size);
+    (void)fclose (in);
+    return ok;
+}
+
+
+/* 
+ * load_photo_cache
+ *   DESCRIPTION: Map a room photo cache file into memory and create a 
+ *                photo structure from it, provided that the cache is
+ *                well-formed and was made from the current version of
+ *                the source file.
+ *   INPUTS: cname -- name of cache file
+ *           src -- status of source photo file
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
+ *                 if the cache is missing, stale, or unusable
+ *   SIDE EFFECTS: dynamically allocates memory for the photo and maps
+ *                 the cache file
+ */
+static photo_t*
+load_photo_cache (const char* cname, const struct stat* src)
+{
+    int                         fd;	/* cache file descriptor     */
+    struct stat                 cst;	/* cache file status         */
+    void*                       map;	/* mapping of cache file     */
+    const photo_cache_header_t* ch;	/* header of cache file      */
+    photo_t*                    p;	/* photo structure           */
+
+    if (0 > (fd = open (cname, O_RDONLY))) {
+        return NULL;
+    }
+    if (0 != fstat (fd, &cst) || sizeof (*ch) > (size_t)cst.st_size ||
+	MAP_FAILED == (map = mmap (NULL, cst.st_size, PROT_READ, MAP_PRIVATE,
+				   fd, 0))) {
+	(void)close (fd);
+	return NULL;
+    }
+    (void)close (fd);
+
+    ch = map;
+    if (PHOTO_CACHE_MAGIC != ch->magic ||
+	PHOTO_CACHE_VERSION != ch->version ||
+	(uint64_t)src->st_size != ch->src_size ||
+	src->st_mtim.tv_sec != ch->src_sec ||
+	src->st_mtim.tv_nsec != ch->src_nsec ||
+	MAX_PHOTO_WIDTH < ch->hdr.width ||
+	MAX_PHOTO_HEIGHT < ch->hdr.height ||
+	sizeof (*ch) + ch->hdr.width * ch->hdr.height != 
+		(size_t)cst.st_size ||
+	NULL == (p = malloc (sizeof (*p)))) {
+	(void)munmap (map, cst.st_size);
+	return NULL;
+    }
+    p->hdr = ch->hdr;
+    (void)memcpy (p->palette, ch->palette, sizeof (p->palette));
+    p->img = (uint8_t*)map + sizeof (*ch);
+    p->map = map;
+    p->map_len = cst.st_size;
+    return p;
+}
+
 
-int q_sort_compare(const void *A, const void *B ){
-	return (int)(((colors_t*)B)->count - ((colors_t*)A)->count);
+/* 
+ * write_photo_cache
+ *   DESCRIPTION: Save a decoded room photo as a cache file.  The data are
+ *                written to a temporary file that is then renamed, so 
+ *                that a partly written cache is never seen by other 
+ *                readers.  Failure (for example, a read-only directory)
+ *                is silently ignored.
+ *   INPUTS: cname -- name of cache file
+ *           src -- status of source photo file
+ *           p -- the decoded photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: creates or replaces the cache file
+ */
+static void
+write_photo_cache (const char* cname, const struct stat* src, 
+		   const photo_t* p)
+{
+    char                 tmp[FILENAME_MAX]; /* temporary file name   */
+    photo_cache_header_t ch;	/* header of cache file              */
+    int                  fd;	/* temporary file descriptor         */
+    FILE*                out;	/* temporary file                    */
+    size_t               n;	/* number of pixels in photo         */
+    int32_t              ok;	/* was the file written completely?  */
+    int                  len;	/* length of temporary file name     */
+
+    len = snprintf (tmp, sizeof (tmp), "%s.XXXXXX", cname);
+    if (0 > len || sizeof (tmp) <= (size_t)len || 0 > (fd = mkstemp (tmp))) {
+        return;
+    }
+    (void)fchmod (fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (NULL == (out = fdopen (fd, "wb"))) {
+        (void)close (fd);
+	(void)unlink (tmp);
+	return;
+    }
+
+    /* Clear the header first so that no padding bytes are left random. */
+    (void)memset (&ch, 0, sizeof (ch));
+    ch.magic = PHOTO_CACHE_MAGIC;
+    ch.version = PHOTO_CACHE_VERSION;
+    ch.src_size = src->st_size;
+    ch.src_sec = src->st_mtim.tv_sec;
+    ch.src_nsec = src->st_mtim.tv_nsec;
+    ch.hdr = p->hdr;
+    (void)memcpy (ch.palette, p->palette, sizeof (ch.palette));
+
+    n = p->hdr.width * p->hdr.height;
+    ok = (1 == fwrite (&ch, sizeof (ch), 1, out) &&
+	  n == fwrite (p->img, sizeof (p->img[0]), n, out));
+    if (0 != fclose (out) || !ok || 0 != rename (tmp, cname)) {
+        (void)unlink (tmp);
+    }
+}
+
+
+/* 
+ * photo_cols
+ *   DESCRIPTION: Get a copy of a room photo's pixels stored by column,
+ *                making the copy if the last one made was of another
+ *                photo.  Photos larger than the budget set with
+ *                photo_set_col_budget are not copied.
+ *   INPUTS: p -- the room photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: the photo's pixels by column, or NULL if the photo is
+ *                 too large or memory runs out
+ *   SIDE EFFECTS: replaces the previous column copy; may allocate memory
+ */
+static const uint8_t*
+photo_cols (const photo_t* p)
+{
+    size_t   n;	    /* bytes in photo              */
+    uint8_t* grown; /* reallocated copy            */
+    int32_t  w;	    /* photo width                 */
+    int32_t  h;	    /* photo height                */
+    int32_t  bx;    /* left column of block        */
+    int32_t  by;    /* top row of block            */
+    int32_t  x;	    /* index over columns in block */
+    int32_t  y;	    /* index over rows in block    */
+    int32_t  x_end; /* column after block          */
+    int32_t  y_end; /* row after block             */
+
+    if (p->serial == col_copy_serial) {
+        return col_copy;
+    }
+    w = p->hdr.width;
+    h = p->hdr.height;
+    n = (size_t)w * h;
+    if (col_budget < n) {
+        return NULL;
+    }
+    if (col_copy_size < n) {
+        if (NULL == (grown = realloc (col_copy, n))) {
+	    return NULL;
+	}
+	col_copy = grown;
+	col_copy_size = n;
+    }
+
+    /* Move square blocks so that reads and writes both stay in cache. */
+    for (by = 0; h > by; by += PHOTO_COL_BLOCK) {
+	y_end = (h < by + PHOTO_COL_BLOCK ? h : by + PHOTO_COL_BLOCK);
+	for (bx = 0; w > bx; bx += PHOTO_COL_BLOCK) {
+	    x_end = (w < bx + PHOTO_COL_BLOCK ? w : bx + PHOTO_COL_BLOCK);
+	    for (x = bx; x_end > x; x++) {
+		for (y = by; y_end > y; y++) {
+		    col_copy[h * x + y] = p->img[w * y + x];
+		}
+	    }
+	}
+    }
+    col_copy_serial = p->serial;
+    return col_copy;
+}
+
+
+/* 
+ * photo_set_cache
+ *   DESCRIPTION: Choose whether read_photo uses room photo cache files.
+ *                Caching is on by default.  Call before loading photos.
+ *   INPUTS: use -- non-zero to read and write caches, 0 to always
+ *                  decode the source files
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes caching behavior of read_photo
+ */
+void
+photo_set_cache (int32_t use)
+{
+    use_cache = use;
+}
+
+
+/* 
+ * photo_set_col_budget
+ *   DESCRIPTION: Set the size of the largest room photo that is copied 
+ *                by column for drawing vertical lines.  The default is
+ *                PHOTO_COL_BUDGET, which covers every photo.  Call from
+ *                the thread that draws the screen.
+ *   INPUTS: bytes -- largest photo size in bytes, or 0 to never copy
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees the current column copy
+ */
+void
+photo_set_col_budget (uint32_t bytes)
+{
+    free (col_copy);
+    col_copy = NULL;
+    col_copy_size = 0;
+    col_copy_serial = 0;
+    col_budget = bytes;
 }
+
+
 /* 
  * read_photo
  *   DESCRIPTION: Read size and pixel data in 5:6:5 RGB format from a
  *                photo file and create a photo structure from it.
- *                Code provided simply maps to 2:2:2 RGB.  You must
- *                replace this code with palette color selection, and
- *                must map the image pixels into the palette colors that
- *                you have defined.
+ *                The photo's 192 palette colors are chosen with the
+ *                octree quantizer (octree.h), and each pixel is mapped
+ *                to the palette color of the tree leaf that holds it.
+ *                If an up-to-date cache of the result exists, it is 
+ *                mapped instead; otherwise, one is written after 
+ *                decoding.
  *   INPUTS: fname -- file name for input
  *   OUTPUTS: none
  *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
  *                 on failure
- *   SIDE EFFECTS: dynamically allocates memory for the photo
+ *   SIDE EFFECTS: dynamically allocates memory for the photo; may map
+ *                 or write a cache file
  */
 
 photo_t*
 read_photo (const char* fname)
 {
-    FILE*    in;	/* input file               */
-    photo_t* p = NULL;	/* photo structure          */
-    uint16_t x;		/* index over image columns */
-    uint16_t y;		/* index over image rows    */
-    uint16_t pixel;	/* one pixel from the file  */
-	int s;
+    FILE*     in;		/* input file                 */
+    photo_t*  p = NULL;		/* photo structure            */
+    uint16_t* pixels = NULL;	/* 5:6:5 pixel data from file */
+    octree_t* t = NULL;		/* color quantizer            */
+    size_t    n_pixels;		/* number of pixels in photo  */
+    size_t    i;		/* index over file pixels     */
+    uint16_t  x;		/* index over image columns   */
+    uint16_t  y;		/* index over image rows      */
+    uint8_t   lut[OCTREE_LUT_SIZE]; /* pixel key to VGA color */
+    char      cname[FILENAME_MAX];  /* cache file name        */
+    struct stat st;		/* source file status         */
+    int32_t   cached;		/* use a cache for this file? */
+    int       len;		/* length of cache file name  */
+
+    if (NULL == (in = fopen (fname, "r+b"))) {
+        return NULL;
+    }
+
+    /* Use the cache if it matches the source file that we just opened. */
+    len = snprintf (cname, sizeof (cname), "%s%s", fname, 
+    		    PHOTO_CACHE_SUFFIX);
+    cached = (use_cache && 0 <= len && sizeof (cname) > (size_t)len &&
+	      0 == fstat (fileno (in), &st));
+    if (cached && NULL != (p = load_photo_cache (cname, &st))) {
+	(void)fclose (in);
+	p->serial = __sync_add_and_fetch (&last_serial, 1);
+        return p;
+    }
+
     /* 
-     * Open the file, allocate the structure, read the header, do some
-     * sanity checks on it, and allocate space to hold the photo pixels.
-     * If anything fails, clean up as necessary and return NULL.
+     * Allocate the structure, read the header, do some sanity checks on
+     * it, and allocate space to hold the photo pixels.  Then read all of
+     * the 5:6:5 pixel data with a single call; both passes below work 
+     * from the copy in memory.  If anything fails, clean up as necessary
+     * and return NULL.
      */
-    if (NULL == (in = fopen (fname, "r+b")) ||
-	NULL == (p = malloc (sizeof (*p))) ||
+    if (NULL == (p = malloc (sizeof (*p))) ||
 	NULL != (p->img = NULL) || /* false clause for initialization */
 	1 != fread (&p->hdr, sizeof (p->hdr), 1, in) ||
 	MAX_PHOTO_WIDTH < p->hdr.width ||
 	MAX_PHOTO_HEIGHT < p->hdr.height ||
-	NULL == (p->img = malloc 
-		 (p->hdr.width * p->hdr.height * sizeof (p->img[0])))) {
+	0 == (n_pixels = p->hdr.width * p->hdr.height) ||
+	NULL == (p->img = malloc (n_pixels * sizeof (p->img[0]))) ||
+	NULL == (pixels = malloc (n_pixels * sizeof (pixels[0]))) ||
+	n_pixels != fread (pixels, sizeof (pixels[0]), n_pixels, in) ||
+	NULL == (t = octree_create ())) {
 	if (NULL != p) {
 	    if (NULL != p->img) {
 	        free (p->img);
 	    }
 	    free (p);
 	}
-	if (NULL != in) {
-	    (void)fclose (in);
+	if (NULL != pixels) {
+	    free (pixels);
 	}
+	(void)fclose (in);
 	return NULL;
     }
+    (void)fclose (in);
+    p->map = NULL;
+    p->map_len = 0;
 
     /* 
-     * Loop over rows from bottom to top.  Note that the file is stored
-     * in this order, whereas in memory we store the data in the reverse
-     * order (top to bottom).
+     * Choose the photo's palette.  The first 64 VGA colors are reserved
+     * for the 2:2:2 RGB object images, so the photo gets the other 192;
+     * the quantizer picks them from a histogram of every pixel and gives
+     * back 6-bit RGB values ready for the VGA palette registers.
      */
+    for (i = 0; n_pixels > i; i++) {
+        octree_add_pixel (t, pixels[i]);
+    }
+    (void)octree_reduce (t, PHOTO_COLORS);
+    octree_palette (t, p->palette, PHOTO_COLORS);
+    octree_build_lut (t, 64, lut);
+    octree_destroy (t);
 
-	// set the octree_level four array to 0
-	colors_t color[OCTREE_4_LEVEL] = {{0}};
-
+    /* 
+     * Map the pixels into the palette with one table lookup each.  The
+     * file stores rows from bottom to top, whereas in memory we store the
+     * data in the reverse order (top to bottom).
+     */
+    i = 0;
     for (y = p->hdr.height; y-- > 0; ) {
 
 	/* Loop over columns from left to right. */
-	for (x = 0; p->hdr.width > x; x++) {
+	for (x = 0; p->hdr.width > x; x++, i++) {
+	    p->img[p->hdr.width * y + x] = lut[OCTREE_KEY (pixels[i])];
+	}
+    }
+    free (pixels);
 
-	    /* 
-	     * Try to read one 16-bit pixel.  On failure, clean up and 
-	     * return NULL.
-	     */
-	    if (1 != fread (&pixel, sizeof (pixel), 1, in)) {
-			fprintf(stderr, "1rrors\n");
-			free (p->img);
-			free (p);
-				(void)fclose (in);
-			return NULL;
+    /* Save the result for next time. */
+    if (cached) {
+        write_photo_cache (cname, &st, p);
+    }
+    p->serial = __sync_add_and_fetch (&last_serial, 1);
 
-	    }
-	    /* 
-	     * 16-bit pixel is coded as 5:6:5 RGB (5 bits red, 6 bits green,
-	     * and 6 bits blue).  We change to 2:2:2, which we've set for the
-	     * game objects.  You need to use the other 192 palette colors
-	     * to specialize the appearance of each photo.
-	     *
-	     * In this code, you need to calculate the p->palette values,
-	     * which encode 6-bit RGB as arrays of three uint8_t's.  When
-	     * the game puts up a photo, you should then change the palette 
-	     * to match the colors needed for that photo.
-	     */
+    /* All done.  Return success. */
+    return p;
+}
+
+
+/* 
+ * free_photo
+ *   DESCRIPTION: Release a room photo returned by read_photo.
+ *   INPUTS: p -- room photo pointer
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees dynamically allocated memory or unmaps the
+ *                 photo's cache file
+ */
+void
+free_photo (photo_t* p)
+{
+    if (NULL != p->map) {
+        (void)munmap (p->map, p->map_len);
+    } else {
+        free (p->img);
+    }
+    free (p);
+}
+
+
+#if defined(PHOTO_MAP_BENCHMARK) || defined(SPRITE_BENCHMARK) || \
+    defined(PHOTO_COL_BENCHMARK)
+
+#include <time.h>
+
+/*
+ * The code below is shared by the benchmarks that follow, each of which 
+ * replaces the game.
+ */
+
+/* 
+ * show_status (interface function; declared in world.h)
+ *   DESCRIPTION: Stand-in for the game's status message routine, which
+ *                is needed to link with the world code; discards the 
+ *                message.
+ *   INPUTS: s -- the status message (ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+show_status (const char* s)
+{
+}
+
+
+/* 
+ * elapsed_ms
+ *   DESCRIPTION: Calculate the time between two clock readings.
+ *   INPUTS: start -- earlier reading
+ *           end -- later reading
+ *   OUTPUTS: none
+ *   RETURN VALUE: elapsed time in milliseconds
+ *   SIDE EFFECTS: none
+ */
+static double
+elapsed_ms (const struct timespec* start, const struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000.0 + 
+	   (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
 
-		unsigned int r,g,b;
-		// set the rgb values to the first 4bits of the RGB by parsing the pixel, which stores the RGB in 5:6:5 order 
-		r = pixel>>11;	// first 4 bits of the Red value
-		g = (pixel>>5) & (0x3F); // first 4 bits of the Green value
-		b = pixel & 0x1F; // first 4 bits of the Blue value
+#endif /* photo.c benchmarks */
 
-		int index = 0;
-		// index into the Octree array using the first 4 bits of the RGB value 4:4:4 
-		index = ((((r >> 1) << 4) | (g >> 2 )) << 4) | (b>>1);
 
-		// store old count with current count in the level 4 index array 
-		unsigned int old_count= color[index].count;
-		
-		// the count increases 
-		color[index].count++;
-		
-		// new count 
-		unsigned int new_count = color[index].count;
+#if defined(PHOTO_MAP_BENCHMARK)
 
-		// Average out the RGB values 
-		// (Average Old * old_count)/(new_count) + new_value/new_count 
-		color[index].avgB = ((color[index].avgB*old_count + (b<<1))/(new_count)) ;
+/*
+ * The code below replaces the game with a benchmark of the palette 
+ * mapping pass of read_photo.  For each photo named on the command line,
+ * the photo's pixels are quantized again, every pixel is then mapped both
+ * by walking down the quantizer's tree and with the lookup table used by
+ * read_photo, the two results are compared with each other and with the
+ * photo (and palette) produced by read_photo, and the time taken by each
+ * method is reported.
+ */
 
-		color[index].avgG = ((color[index].avgG*old_count + g)/(new_count));
+#define BENCH_REPS 5	/* mapping passes timed for each method */
 
-		color[index].avgR = ((color[index].avgR*old_count + (r<<1))/(new_count));
 
+/*
+ * main -- for the "photobench" program
+ *   DESCRIPTION: Compare tree walk and table palette mapping.
+ *   INPUTS: argv[1..] -- room photo file names
+ *   OUTPUTS: prints one line of results per photo and a total
+ *   RETURN VALUE: 0 if all mappings match, 3 otherwise
+ */
+int
+main (int argc, char* argv[])
+{
+    struct timespec t0, t1, t2; /* clock readings                     */
+    photo_t*  p;                /* photo as read by read_photo        */
+    FILE*     in;               /* photo file                         */
+    octree_t* t;                /* quantizer rebuilt from the pixels  */
+    uint16_t* pixels;           /* 5:6:5 pixels in file order         */
+    uint8_t*  by_tree;          /* colors found by walking the tree   */
+    uint8_t*  by_lut;           /* colors found by table lookup       */
+    uint8_t   lut[OCTREE_LUT_SIZE]; /* pixel key to VGA color         */
+    uint8_t   palette[PHOTO_COLORS][3]; /* palette from quantizer     */
+    size_t    n;                /* number of pixels in photo          */
+    size_t    i;                /* index over pixels                  */
+    int       f;                /* index over files                   */
+    int       rep;              /* index over repetitions             */
+    int       ok;               /* mappings agree for this photo?     */
+    int       ret_val = 0;      /* program return value               */
+    double    tree_ms;          /* time for tree walk mapping         */
+    double    lut_ms;           /* time for table mapping             */
+    double    tot_tree = 0.0;   /* total tree walk time               */
+    double    tot_lut = 0.0;    /* total table time                   */
+
+    for (f = 1; argc > f; f++) {
+	if (NULL == (p = read_photo (argv[f]))) {
+	    fprintf (stderr, "Can't read room photo %s.\n", argv[f]);
+	    ret_val = 3;
+	    continue;
+	}
+	n = p->hdr.width * p->hdr.height;
+	pixels = malloc (n * sizeof (pixels[0]));
+	by_tree = malloc (n);
+	by_lut = malloc (n);
+	if (NULL == pixels || NULL == by_tree || NULL == by_lut ||
+	    NULL == (t = octree_create ()) ||
+	    NULL == (in = fopen (argv[f], "rb"))) {
+	    perror (argv[f]);
+	    return 3;
 	}
+	if (0 != fseek (in, sizeof (p->hdr), SEEK_SET) ||
+	    n != fread (pixels, sizeof (pixels[0]), n, in)) {
+	    fprintf (stderr, "Can't reread %s.\n", argv[f]);
+	    return 3;
+	}
+	(void)fclose (in);
+	for (i = 0; n > i; i++) {
+	    octree_add_pixel (t, pixels[i]);
+	}
+	(void)octree_reduce (t, PHOTO_COLORS);
+	octree_palette (t, palette, PHOTO_COLORS);
+
+	(void)clock_gettime (CLOCK_MONOTONIC, &t0);
+	for (rep = 0; BENCH_REPS > rep; rep++) {
+	    for (i = 0; n > i; i++) {
+		by_tree[i] = 64 + octree_lookup (t, pixels[i]);
+	    }
+	}
+	(void)clock_gettime (CLOCK_MONOTONIC, &t1);
+	for (rep = 0; BENCH_REPS > rep; rep++) {
+	    octree_build_lut (t, 64, lut);
+	    for (i = 0; n > i; i++) {
+		by_lut[i] = lut[OCTREE_KEY (pixels[i])];
+	    }
+	}
+	(void)clock_gettime (CLOCK_MONOTONIC, &t2);
+	tree_ms = elapsed_ms (&t0, &t1) / BENCH_REPS;
+	lut_ms = elapsed_ms (&t1, &t2) / BENCH_REPS;
+	tot_tree += tree_ms;
+	tot_lut += lut_ms;
+
+	/* The file holds rows bottom to top; the photo, top to bottom. */
+	ok = (0 == memcmp (by_tree, by_lut, n) &&
+	      0 == memcmp (palette, p->palette, sizeof (palette)));
+	for (i = 0; ok && p->hdr.height > i; i++) {
+	    ok = (0 == memcmp (&by_lut[(p->hdr.height - 1 - i) * 
+	    				p->hdr.width],
+			       &p->img[i * p->hdr.width], p->hdr.width));
+	}
+	if (!ok) {
+	    ret_val = 3;
+	}
+	printf ("%-32s %4dx%-4d tree %8.3f ms  table %7.3f ms  %6.1fx  %s\n",
+		argv[f], p->hdr.width, p->hdr.height, tree_ms, lut_ms,
+		tree_ms / lut_ms, (ok ? "identical" : "MISMATCH"));
+
+	octree_destroy (t);
+	free (pixels);
+	free (by_tree);
+	free (by_lut);
+    }
+    if (0.0 < tot_lut) {
+	printf ("total: tree %.3f ms  table %.3f ms  %.1fx\n",
+		tot_tree, tot_lut, tot_tree / tot_lut);
     }
-	// sort the Octtree level 4 in decending order 
-	qsort(color,OCTREE_4_LEVEL, sizeof(colors_t), q_sort_compare);
 
-	int l;
-	// intialize the second level of octrees to 0 
-	colors_t second_level[64] = {{0}};
-	
-	// go through the rest of the level 4 array 
-	for(l = 128; l<OCTREE_4_LEVEL; l++){
-		unsigned int r,g,b;
-		int index = 0;
-		r = (color[l].avgR>>4) & 0x3;
-		g = (color[l].avgG>>4) & 0x3;
-		b = (color[l].avgB>>4) & 0x3;
-		index = (((r << 2) | g) << 2) | b;
-		// fprintf(stderr, "%x\n",index);
+    return ret_val;
+}
 
-		// if (index >63 || index < 0) {
-		// 	fprintf(stderr, "r:%x, g:%x, b:%x. index:%d\n", r, g, b, index);
-		// }
+#endif /* defined(PHOTO_MAP_BENCHMARK) */
 
-		// current level 2 count in old count
-		unsigned int old_count  = second_level[index].count;
-		// store new count with current count in the level 4 index array + level 2 count 
-		unsigned int new_count = color[l].count+old_count;
-		
-		// if(new_count==0){
-			// second_level[index].avgB = color[l].avgB;
 
-			// second_level[index].avgG = color[l].avgG;
+#if defined(SPRITE_BENCHMARK)
 
-			// second_level[index].avgR = color[l].avgR;
+/*
+ * The code below replaces the game with a benchmark of object drawing.
+ * Every row and every column of each object image named on the command
+ * line is drawn into line buffers at offsets that run the object 
+ * across the whole buffer and off both ends, both one pixel at a time 
+ * (as the fill functions once did) and with the runs of opaque pixels 
+ * used by fill_horiz_buffer and fill_vert_buffer.  The results are 
+ * compared, and the time taken per line by each method is reported.
+ *
+ * Before the objects are drawn, each version of blit_masked supported 
+ * by the processor is checked against blit_masked_c on random lines 
+ * drawn at random positions, including positions that clip the line at 
+ * either end of the buffer, and timed on lines of typical length.
+ */
 
-			// second_level[index].count = color[l].count;
-		// 	new_count =1; 
-		// }
-		// else{
-		// running average for RBG values 
-		//(Average Old * old_count)/(new_count) + new_value/new_count
-			second_level[index].avgB = ((second_level[index].avgB*old_count)+(color[l].avgB*color[l].count))/(new_count);
+#include <stdlib.h>
 
-			second_level[index].avgG = ((second_level[index].avgG*old_count)+(color[l].avgG*color[l].count))/(new_count);
+#define BENCH_REPS  20	   /* passes timed for each method         */
+#define BLIT_TRIALS 100000 /* random lines checked for each kernel */
+#define BLIT_REPS   200000 /* lines timed for each kernel          */
 
-			second_level[index].avgR = ((second_level[index].avgR*old_count)+(color[l].avgR*color[l].count))/(new_count);
+/* versions of blit_masked */
+typedef struct blit_kernel_t blit_kernel_t;
+struct blit_kernel_t {
+    const char* name;	/* name to print                 */
+    const char* feature; /* processor feature needed, or NULL */
+    void (*fn) (uint8_t* dst, const uint8_t* src, int32_t n);
+};
+static const blit_kernel_t blit_kernels[] = {
+    {"scalar", NULL, blit_masked_c},
+#if defined(__i386__) || defined(__x86_64__)
+    {"sse2", "sse2", blit_masked_sse2},
+    {"avx2", "avx2", blit_masked_avx2},
+#endif
+};
+#define N_BLIT_KERNELS (sizeof (blit_kernels) / sizeof (blit_kernels[0]))
 
-			second_level[index].count = new_count;
-			// fprintf(stderr, "%x\n",new_count);
+/* 
+ * draw_pixels
+ *   DESCRIPTION: Draw one row or column of an object image into a line
+ *                buffer one pixel at a time, skipping transparent 
+ *                pixels.
+ *   INPUTS: pix -- first pixel of the row or column
+ *           n -- number of pixels
+ *           stride -- distance between successive pixels in memory
+ *           d -- buffer position of the first pixel
+ *           len -- length of the buffer
+ *   OUTPUTS: buf -- line buffer
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+draw_pixels (const uint8_t* pix, int32_t n, int32_t stride, int32_t d,
+	     int32_t len, unsigned char* buf)
+{
+    int32_t i;		/* index over pixels */
 
-		// }
+    for (i = 0; n > i; i++) {
+	if (0 <= d + i && len > d + i && 
+	    OBJ_CLR_TRANSP != pix[i * stride]) {
+	    buf[d + i] = pix[i * stride];
+	}
+    }
+}
 
 
+/* 
+ * cpu_supports
+ *   DESCRIPTION: Check whether the processor has a feature needed by a 
+ *                version of blit_masked.
+ *   INPUTS: feature -- name of the feature, or NULL for none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if supported, 0 if not
+ *   SIDE EFFECTS: none
+ */
+static int
+cpu_supports (const char* feature)
+{
+    if (NULL == feature) {
+        return 1;
+    }
+#if defined(__i386__) || defined(__x86_64__)
+    if (0 == strcmp (feature, "sse2")) {
+        return (0 != __builtin_cpu_supports ("sse2"));
+    }
+    if (0 == strcmp (feature, "avx2")) {
+        return (0 != __builtin_cpu_supports ("avx2"));
+    }
+#endif
+    return 0;
+}
+
 
+/* 
+ * check_blit_kernels
+ *   DESCRIPTION: Check each supported version of blit_masked against 
+ *                blit_masked_c on random lines at random positions, 
+ *                and time each on lines of typical object width.
+ *   INPUTS: none
+ *   OUTPUTS: prints one line of results per version
+ *   RETURN VALUE: 1 if all versions match, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+static int
+check_blit_kernels ()
+{
+    static uint8_t src[MAX_OBJECT_WIDTH];    /* random object line    */
+    static uint8_t want[SCROLL_X_DIM];       /* drawn by blit_masked_c */
+    static uint8_t got[SCROLL_X_DIM];        /* drawn by kernel        */
+    struct timespec t0, t1; /* clock readings                          */
+    unsigned int    k;      /* index over kernels                      */
+    int32_t         trial;  /* index over random lines                 */
+    int32_t         len;    /* length of line                          */
+    int32_t         d;      /* buffer position of line                 */
+    int32_t         lo;     /* first line pixel drawn                  */
+    int32_t         hi;     /* line pixel after last drawn             */
+    int32_t         i;      /* index over pixels                       */
+    int             ok;     /* kernel agrees with blit_masked_c?       */
+    int             all_ok = 1; /* all kernels agree?                  */
+
+    for (k = 0; N_BLIT_KERNELS > k; k++) {
+	if (!cpu_supports (blit_kernels[k].feature)) {
+	    printf ("blit %-6s not supported\n", blit_kernels[k].name);
+	    continue;
+	}
+	srand (391);
+	for (ok = 1, trial = 0; ok && BLIT_TRIALS > trial; trial++) {
+	    /* Mix long runs with single pixels of either kind. */
+	    len = 1 + rand () % MAX_OBJECT_WIDTH;
+	    for (i = 0; len > i; i++) {
+		src[i] = (0 == rand () % (1 + trial % 8) ? 
+			  OBJ_CLR_TRANSP : rand () & 0xFF);
+	    }
+	    d = rand () % (SCROLL_X_DIM + len) - len;
+	    lo = (0 > d ? -d : 0);
+	    hi = (SCROLL_X_DIM < d + len ? SCROLL_X_DIM - d : len);
+	    for (i = 0; SCROLL_X_DIM > i; i++) {
+		want[i] = got[i] = rand () & 0xFF;
+	    }
+	    blit_masked_c (&want[d + lo], &src[lo], hi - lo);
+	    (*blit_kernels[k].fn) (&got[d + lo], &src[lo], hi - lo);
+	    ok = (0 == memcmp (want, got, SCROLL_X_DIM));
+	}
+	all_ok = (all_ok && ok);
 
+	(void)clock_gettime (CLOCK_MONOTONIC, &t0);
+	for (trial = 0; BLIT_REPS > trial; trial++) {
+	    (*blit_kernels[k].fn) (&got[trial & 0x3F], src, 64);
+	}
+	(void)clock_gettime (CLOCK_MONOTONIC, &t1);
+	printf ("blit %-6s %6.1f ns per 64 pixels  %s\n", 
+		blit_kernels[k].name, 
+		elapsed_ms (&t0, &t1) * 1e6 / BLIT_REPS,
+		(ok ? "identical" : "MISMATCH"));
+    }
+    return all_ok;
+}
 
 
+/*
+ * main -- for the "spritebench" program
+ *   DESCRIPTION: Compare per-pixel and run-based object drawing.
+ *   INPUTS: argv[1..] -- object image file names
+ *   OUTPUTS: prints one line of results per object and a total
+ *   RETURN VALUE: 0 if all drawings match, 3 otherwise
+ */
+int
+main (int argc, char* argv[])
+{
+    static unsigned char old_h[SCROLL_X_DIM]; /* per-pixel row drawing */
+    static unsigned char new_h[SCROLL_X_DIM]; /* run-based row drawing */
+    static unsigned char old_v[SCROLL_Y_DIM]; /* per-pixel col drawing */
+    static unsigned char new_v[SCROLL_Y_DIM]; /* run-based col drawing */
+    struct timespec t0, t1, t2; /* clock readings                     */
+    image_t* img;               /* object image                       */
+    int32_t  w;                 /* image width                        */
+    int32_t  h;                 /* image height                       */
+    int32_t  x;                 /* index over image columns           */
+    int32_t  y;                 /* index over image rows              */
+    int32_t  d;                 /* buffer position of image edge      */
+    int32_t  n_lines;           /* lines drawn per pass               */
+    int      f;                 /* index over files                   */
+    int      rep;               /* index over repetitions             */
+    int      ok;                /* drawings agree for this object?    */
+    int      ret_val = 0;       /* program return value               */
+    double   old_ms;            /* time for per-pixel drawing         */
+    double   new_ms;            /* time for run-based drawing         */
+    double   tot_old = 0.0;     /* total time for per-pixel drawing   */
+    double   tot_new = 0.0;     /* total time for run-based drawing   */
+
+    if (!check_blit_kernels ()) {
+        ret_val = 3;
+    }
 
+    for (f = 1; argc > f; f++) {
+        if (NULL == (img = read_obj_image (argv[f]))) {
+	    fprintf (stderr, "%s: could not read image\n", argv[f]);
+	    return 3;
+	}
+	w = img->hdr.width;
+	h = img->hdr.height;
+
+	/* Check that both methods draw the same pixels. */
+	ok = 1;
+	for (d = -w - 1; ok && SCROLL_X_DIM + 1 >= d; d++) {
+	    for (y = 0; ok && h > y; y++) {
+		(void)memset (old_h, d & 0xFF, SCROLL_X_DIM);
+		(void)memset (new_h, d & 0xFF, SCROLL_X_DIM);
+		draw_pixels (&img->img[w * y], w, 1, d, SCROLL_X_DIM, old_h);
+		copy_obj_row (img, y, d, new_h);
+		ok = (0 == memcmp (old_h, new_h, SCROLL_X_DIM));
+	    }
 	}
-	// load the first 128 palette from the first 128 values in the octtrees level 4
-	for(l = 0; l<128; l++){
-		p->palette[l][0] = color[l].avgR;
-		p->palette[l][1] = color[l].avgG;
-		p->palette[l][2] = color[l].avgB;
-		// fprintf(stderr,"%x,%x,%x\n",p->palette[l][0],p->palette[l][1],p->palette[l][2]);
+	for (d = -h - 1; ok && SCROLL_Y_DIM + 1 >= d; d++) {
+	    for (x = 0; ok && w > x; x++) {
+		(void)memset (old_v, d & 0xFF, SCROLL_Y_DIM);
+		(void)memset (new_v, d & 0xFF, SCROLL_Y_DIM);
+		draw_pixels (&img->img[x], h, w, d, SCROLL_Y_DIM, old_v);
+		copy_obj_col (img, x, d, new_v);
+		ok = (0 == memcmp (old_v, new_v, SCROLL_Y_DIM));
+	    }
 	}
-	// load the last 64 palette from the values in the octtrees level 2
-	for(s=128;s<192;s++){
-		p->palette[s][0] = second_level[s-128].avgR;
-		p->palette[s][1] = second_level[s-128].avgG;
-		p->palette[s][2] = second_level[s-128].avgB;
-		// fprintf(stderr,"%x,%x,%x\n",p->palette[l][0],p->palette[l][1],p->palette[l][2]);
+	if (!ok) {
+	    ret_val = 3;
 	}
 
-	// rewind the file pointer to 0
-	fseek(in, sizeof(p->hdr), SEEK_SET);
-	// rewind(in);
-	for (y = p->hdr.height; y-- > 0; ) {
-
-	/* Loop over columns from left to right. */
-		for (x = 0; p->hdr.width > x; x++) {
-			if (1 != fread (&pixel, sizeof (pixel), 1, in)) {
-				fprintf(stderr, "errors\n");
-				free (p->img);
-				free (p);
-					(void)fclose (in);
-				return NULL;
-			}
-			int palette_value = 0;
-
-			unsigned int r,g,b;
-
-			// stores the rgb value of the pixel
-			r = pixel>>11 & 0x1F; // gets the 5 bits of the red
-			g = (pixel>>5) & (0x3F); // gets the 6 bits of the green
-			b = pixel & 0x1F; // gets the 5 bits of the blue
-
-			for(l = 0; l<192 ; l++){
-				
-				unsigned int c_r,c_g,c_b;
-
-				// sets the rgb values with current palette values
-				c_r = p->palette[l][0]; 
-				c_g = p->palette[l][1];
-				c_b = p->palette[l][2]; 
-				
-				// if palette is in the first 128 colors
-				if(l < 128){
-					// checks the first 4 bits of RGB with pixel's first 4 bits of RGB
-					if((r>>1)==(c_r>>2) && (g>>2)==(c_g>>2) && (b>>1)==(c_b>>2)){
-						palette_value = l;
-						break;
-					}
-				}
-				else{
-					// checks the first 2 bits of RGB with pixel's first 2 bits of RGB
-					if((r>>3)==(c_r>>4) && (g>>4)==(c_g>>4) && (b>>3)==(c_b>>4)){
-						palette_value = l;
-						break;
-					}
-				}
-
-			}
-			// sets the images index into the palette and offsets it by 64 to account for previous 64 colors
-			p->img[p->hdr.width * y + x] = palette_value+64;
+	/* Time drawing every row and column at a few positions. */
+	n_lines = 3 * (w + h);
+	(void)clock_gettime (CLOCK_MONOTONIC, &t0);
+	for (rep = 0; BENCH_REPS > rep; rep++) {
+	    for (d = -w / 2; SCROLL_X_DIM > d; d += SCROLL_X_DIM / 2) {
+		for (y = 0; h > y; y++) {
+		    draw_pixels (&img->img[w * y], w, 1, d, SCROLL_X_DIM, 
+		    		 old_h);
 		}
+	    }
+	    for (d = -h / 2; SCROLL_Y_DIM > d; d += SCROLL_Y_DIM / 2) {
+		for (x = 0; w > x; x++) {
+		    draw_pixels (&img->img[x], h, w, d, SCROLL_Y_DIM, old_v);
+		}
+	    }
 	}
-	
+	(void)clock_gettime (CLOCK_MONOTONIC, &t1);
+	for (rep = 0; BENCH_REPS > rep; rep++) {
+	    for (d = -w / 2; SCROLL_X_DIM > d; d += SCROLL_X_DIM / 2) {
+		for (y = 0; h > y; y++) {
+		    copy_obj_row (img, y, d, new_h);
+		}
+	    }
+	    for (d = -h / 2; SCROLL_Y_DIM > d; d += SCROLL_Y_DIM / 2) {
+		for (x = 0; w > x; x++) {
+		    copy_obj_col (img, x, d, new_v);
+		}
+	    }
+	}
+	(void)clock_gettime (CLOCK_MONOTONIC, &t2);
+	old_ms = elapsed_ms (&t0, &t1) / BENCH_REPS;
+	new_ms = elapsed_ms (&t1, &t2) / BENCH_REPS;
+	tot_old += old_ms;
+	tot_new += new_ms;
+
+	printf ("%-28s %3dx%-3d %4d runs  pixels %6.1f ns/line  "
+		"runs %6.1f ns/line  %5.1fx  %s\n",
+		argv[f], w, h, img->col_first[w], 
+		old_ms * 1e6 / n_lines, new_ms * 1e6 / n_lines, 
+		old_ms / new_ms, (ok ? "identical" : "MISMATCH"));
+    }
+    if (0.0 < tot_new) {
+	printf ("total: pixels %.3f ms  runs %.3f ms  %.1fx\n",
+		tot_old, tot_new, tot_old / tot_new);
+    }
 
-    /* All done.  Return success. */
-    (void)fclose (in);
-    return p;
+    return ret_val;
 }
 
+#endif /* defined(SPRITE_BENCHMARK) */
+
+
+#if defined(PHOTO_COL_BENCHMARK)
+
+/*
+ * The code below replaces the game with a benchmark of the room photo
+ * part of drawing vertical lines (fill_photo_col, called by 
+ * fill_vert_buffer for draw_vert_line).  For each photo named on the 
+ * command line, every column of the photo is drawn at the top, middle,
+ * and bottom of the photo, first reading the photo a row at a time and 
+ * then from its column copy.  The lines are compared, and the time per
+ * line for each method and the time taken to make the copy are 
+ * reported.
+ */
+
+#define BENCH_REPS 20	/* passes timed for each method */
+
+/* 
+ * sweep_cols
+ *   DESCRIPTION: Draw every column of a photo at three heights.
+ *   INPUTS: p -- the room photo
+ *   OUTPUTS: lines -- the lines drawn, 3 * width of them, or NULL to 
+ *                     discard them
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+sweep_cols (const photo_t* p, unsigned char (*lines)[SCROLL_Y_DIM])
+{
+    static unsigned char scratch[SCROLL_Y_DIM]; /* discarded line    */
+    int32_t bottom;	/* top row of view at bottom of photo */
+    int32_t x;		/* index over columns                 */
+    int32_t k;		/* index over heights                 */
+    int32_t y;		/* top row of view                    */
+
+    bottom = p->hdr.height - SCROLL_Y_DIM;
+    for (k = 0; 3 > k; k++) {
+        y = (0 < bottom ? bottom * k / 2 : 0);
+	for (x = 0; p->hdr.width > x; x++) {
+	    fill_photo_col (p, x, y, (NULL == lines ? scratch : 
+	    			      lines[p->hdr.width * k + x]));
+	}
+    }
+}
+
+
+/*
+ * main -- for the "colbench" program
+ *   DESCRIPTION: Compare drawing vertical lines of photos by row and
+ *                from a column copy.
+ *   INPUTS: argv[1..] -- room photo file names
+ *   OUTPUTS: prints one line of results per photo and a total
+ *   RETURN VALUE: 0 if all lines match, 3 otherwise
+ */
+int
+main (int argc, char* argv[])
+{
+    struct timespec t0, t1, t2, t3; /* clock readings                 */
+    photo_t*  p;                /* photo as read by read_photo        */
+    unsigned char (*by_row)[SCROLL_Y_DIM]; /* lines read by row       */
+    unsigned char (*by_col)[SCROLL_Y_DIM]; /* lines read by column    */
+    size_t    n;                /* bytes of lines drawn               */
+    int32_t   n_lines;          /* lines drawn per pass               */
+    int       f;                /* index over files                   */
+    int       rep;              /* index over repetitions             */
+    int       ok;               /* lines agree for this photo?        */
+    int       ret_val = 0;      /* program return value               */
+    double    row_ms;           /* time for reading by row            */
+    double    col_ms;           /* time for reading by column         */
+    double    copy_ms;          /* time to make column copy           */
+    double    tot_row = 0.0;    /* total time for reading by row      */
+    double    tot_col = 0.0;    /* total time for reading by column   */
+    double    tot_copy = 0.0;   /* total time to make column copies   */
+
+    for (f = 1; argc > f; f++) {
+        if (NULL == (p = read_photo (argv[f]))) {
+	    fprintf (stderr, "%s: could not read photo\n", argv[f]);
+	    return 3;
+	}
+	n_lines = 3 * p->hdr.width;
+	n = n_lines * sizeof (by_row[0]);
+	if (NULL == (by_row = malloc (n)) || NULL == (by_col = malloc (n))) {
+	    fputs ("out of memory\n", stderr);
+	    return 3;
+	}
+
+	/* Read by row. */
+	photo_set_col_budget (0);
+	sweep_cols (p, by_row);
+	(void)clock_gettime (CLOCK_MONOTONIC, &t0);
+	for (rep = 0; BENCH_REPS > rep; rep++) {
+	    sweep_cols (p, NULL);
+	}
+	(void)clock_gettime (CLOCK_MONOTONIC, &t1);
+
+	/* Make the column copy, then read from it. */
+	photo_set_col_budget (PHOTO_COL_BUDGET);
+	(void)photo_cols (p);
+	(void)clock_gettime (CLOCK_MONOTONIC, &t2);
+	for (rep = 0; BENCH_REPS > rep; rep++) {
+	    sweep_cols (p, NULL);
+	}
+	(void)clock_gettime (CLOCK_MONOTONIC, &t3);
+	sweep_cols (p, by_col);
+
+	row_ms = elapsed_ms (&t0, &t1) / BENCH_REPS;
+	copy_ms = elapsed_ms (&t1, &t2);
+	col_ms = elapsed_ms (&t2, &t3) / BENCH_REPS;
+	tot_row += row_ms;
+	tot_col += col_ms;
+	tot_copy += copy_ms;
+
+	ok = (0 == memcmp (by_row, by_col, n));
+	if (!ok) {
+	    ret_val = 3;
+	}
+	printf ("%-28s %4dx%-4d rows %6.1f ns/line  cols %6.1f ns/line  "
+		"%5.1fx  copy %6.3f ms  %s\n",
+		argv[f], p->hdr.width, p->hdr.height, 
+		row_ms * 1e6 / n_lines, col_ms * 1e6 / n_lines, 
+		row_ms / col_ms, copy_ms, (ok ? "identical" : "MISMATCH"));
+
+	free (by_row);
+	free (by_col);
+	free_photo (p);
+    }
+    if (0.0 < tot_col) {
+	printf ("total: rows %.3f ms  cols %.3f ms  %.1fx  copies %.3f ms\n",
+		tot_row, tot_col, tot_row / tot_col, tot_copy);
+    }
+
+    return ret_val;
+}
 
+#endif /* defined(PHOTO_COL_BENCHMARK) */
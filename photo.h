@@ -56,9 +56,23 @@
 /* Fill a buffer with the pixels for a horizontal line of current room. */
 extern void fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM]);
 
+/* 
+ * Fill a buffer with the pixels for several adjacent horizontal lines of 
+ * current room.
+ */
+extern void fill_horiz_block (int x, int y, int height,
+			      unsigned char buf[MAX_BLOCK_HEIGHT][SCROLL_X_DIM]);
+
 /* Fill a buffer with the pixels for a vertical line of current room. */
 extern void fill_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM]);
 
+/* 
+ * Fill a buffer with the pixels for several adjacent vertical lines of 
+ * current room, one line per row.
+ */
+extern void fill_vert_strip (int x, int y, int width,
+			     unsigned char buf[MAX_STRIP_WIDTH][SCROLL_Y_DIM]);
+
 /* Get height of object image in pixels. */
 extern uint32_t image_height (const image_t* im);
 
@@ -83,6 +97,21 @@ extern image_t* read_obj_image (const char* fname);
 /* Read room photo from a file into a dynamically allocated structure. */
 extern photo_t* read_photo (const char* fname);
 
+/* Read the size of a room photo without decoding it.  Returns 1 on success. */
+extern int32_t read_photo_size (const char* fname, photo_header_t* hdr);
+
+/* Release a room photo returned by read_photo. */
+extern void free_photo (photo_t* p);
+
+/* Enable (the default) or disable room photo cache files. */
+extern void photo_set_cache (int32_t use);
+
+/* 
+ * Set the largest room photo (in bytes) copied by column to speed up
+ * drawing vertical lines (0 to never copy).
+ */
+extern void photo_set_col_budget (uint32_t bytes);
+
 /* 
  * N.B.  I'm aware that Valgrind and similar tools will report the fact that
  * I chose not to bother freeing image data before terminating the program.
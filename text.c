@@ -36,8 +36,43 @@
 #include <string.h>
 
 #include "text.h"
-#define SIZE_STATUS_BAR 320*18
-#define STATUS_BAR_PLANE 1440 
+
+#define STATUS_X_DIM      320  /* pixels across status bar          */
+#define STATUS_ROWS        18  /* pixel rows in status bar          */
+#define STATUS_BAR_PLANE 1440  /* bytes in each plane of status bar */
+#define STATUS_CELLS     (STATUS_X_DIM / FONT_WIDTH)  /* 8-pixel cells */
+#define STATUS_TEXT_COLOR  0x20 /* red                              */
+#define STATUS_BACK_COLOR  0x05 /* teal                             */
+
+/* the cursor is shown while fewer characters than this are typed */
+#define TYPED_CURSOR_LEN   20
+
+/* longest string remembered between status bar images */
+#define STATUS_TEXT_MAX    80
+
+/* a string remembered between status bar images */
+typedef struct {
+    char s[STATUS_TEXT_MAX + 1]; /* the string                    */
+    int  fits;                   /* s holds the string?           */
+} status_text_t;
+
+/* local functions--see function headers for details */
+static int same_text (status_text_t* last, const char* s);
+static void place_text (unsigned char cells[STATUS_ROWS][STATUS_CELLS], 
+			const char* s, int x, int y);
+static void set_cell_planes ();
+
+/* strings and image of the last status bar set up */
+static status_text_t last_text[3];             /* name, typed, message */
+static unsigned char last_cells[STATUS_ROWS][STATUS_CELLS]; /* bits     */
+static const unsigned char* last_buf = NULL;   /* buffer holding image */
+
+/* 
+ * planar image of one row of a cell for each pattern of bits: plane p 
+ * holds cell_planes[bits][p][0] and cell_planes[bits][p][1]
+ */
+static unsigned char cell_planes[256][4][2];
+static int cell_planes_set = 0;                /* cell_planes filled?  */
 
 /* 
  * These font data were read out of video memory during text mode and
@@ -562,184 +597,308 @@ unsigned char font_data[256][16] = {
     {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}
 };
-/**
+/*
  * set_text_to_buffer
- * 
- *    DESCRIPTION: function that sets up the buffer for the status bar given the strings that need to be displayed 
- * 
- *    INPUTS: string -- string of the location name of the image 
- *            input --  string of the typed value of the user displayed on the rightside
- *            status_msg -- string of the message given due to game mechanics and centered in the status bar 
- *            buf -- plane formated buffer in order for the VGA memory to read and display  
- *    
- *    OUPUTS: NONE
- * 
- *    RETURN: NONE
- * 
- *    EFFECTS: The planar buffer of the status bar is set for the VGA 
- * 
+ *   DESCRIPTION: Set up the planar image of the status bar for the strings
+ *                to be displayed.  With no status message, the location
+ *                name is shown on the left and the typed text (followed 
+ *                by an underscore cursor while there is room for more) on
+ *                the right; otherwise, the status message is centered.
+ *                The strings are remembered between calls, so nothing is
+ *                done if they have not changed since the last call with
+ *                the same buffer.  Otherwise, the bits of each 8-pixel 
+ *                cell are found from the font, and only the cells that 
+ *                differ from the last image are written into the buffer.
+ *   INPUTS: string -- location name of the room photo
+ *           input -- text typed by the user
+ *           status_msg -- status message, or "" for none
+ *           buf -- the image set by the last call (if any)
+ *   OUTPUTS: buf -- one plane after another (STATUS_BAR_PLANE bytes each)
+ *   RETURN VALUE: number of cells written into the buffer (0 if the 
+ *                 image is unchanged)
+ *   SIDE EFFECTS: remembers the strings and the image
  */
-void set_text_to_buffer(const char *string,const char* input, const char * status_msg, unsigned char *buf){
-
-    // buffer to hold the graphic version of the strings given 
-   unsigned int buffer[SIZE_STATUS_BAR]; 
-//    if(strlen(input)<20){
-//         char input_with_underscore[strlen(input)+1];
-//         strcat(input_with_underscore,&input,strlen(input));
-//         strcat(input_with_underscore,'_',1); 
-//    }
-//     else{
-//         char input_with_underscore[strlen(input)];
-//         strcat(input_with_underscore,&input,strlen(input));
-//     }
-//    char input_with_underscore[str]
-   int j,i,l;
-   // iterate through the graphic buffer to set initially to 1 
-   // goes through the rows of the status bar 
-   for(j=0;j<18;j++){
-        // goes through the columns of the status bar  
-        for(i=0; i<320;i++){
-            // sets the value to 1 
-            buffer[j*320+i] = 1;
-        }
+int
+set_text_to_buffer (const char* string, const char* input, 
+		    const char* status_msg, unsigned char* buf)
+{
+    unsigned char cells[STATUS_ROWS][STATUS_CELLS]; /* bits of each cell */
+    unsigned char* addr;   /* first pixel of a cell in plane 0           */
+    unsigned char (*px)[2]; /* planar image of a row of a cell            */
+    int typed_len;         /* characters taken up by the typed text      */
+    int offset;            /* cells before a centered message            */
+    int len;               /* length of status message                   */
+    int same;              /* strings same as last time?                 */
+    int changed = 0;       /* number of cells written                    */
+    int x, y;              /* loop indices over cells and rows           */
+    int p;                 /* loop index over planes                     */
+
+    /* 
+     * Nothing to do if the strings are the same as last time.  All three
+     * are checked so that all three are remembered.
+     */
+    same = same_text (&last_text[0], string);
+    same &= same_text (&last_text[1], input);
+    same &= same_text (&last_text[2], status_msg);
+    if (same && buf == last_buf)
+	return 0;
+
+    (void)memset (cells, 0, sizeof (cells));
+    if (status_msg[0] == '\0') {
+	/* 
+	 * The location name goes at the left, and the typed text at the
+	 * right, followed by the cursor while more can be typed.
+	 */
+	place_text (cells, string, 0, 1);
+	typed_len = strlen (input);
+	if (typed_len < TYPED_CURSOR_LEN) {
+	    place_text (cells, "_", STATUS_X_DIM - FONT_WIDTH, 1);
+	    typed_len++;
+	}
+	place_text (cells, input, STATUS_X_DIM - typed_len * FONT_WIDTH, 1);
+    } else {
+	/* 
+	 * The status message is centered, so odd-length messages start 
+	 * halfway through a cell.  They are also drawn one row higher.
+	 */
+	len = strlen (status_msg);
+	offset = (STATUS_CELLS - len) / 2 * FONT_WIDTH;
+	if (len % 2 == 0)
+	    place_text (cells, status_msg, offset, 1);
+	else
+	    place_text (cells, status_msg, offset + FONT_WIDTH / 2, 0);
     }
-    
-    // if the status message is empry then print the location and user input 
-    if(status_msg[0]=='\0'){
-        // sets the the graphic buffer to hold the location on the left side 
-        // goes through the rows of the status bar 
-        for(j=0; j<18;j++){
-            // if(j==0 || j>=17) continue;
-            // goes through the string in order for it to be added to the graphic buffer
-            for(i = 0; i<strlen(string); i++ ){
-                // get the ascii value of the character from the string 
-                int ascii = string[i];
-                // get the row of ascii character from the font rom 
-                char row = font_data[ascii][j];
-                // go through the row of the ascii character 
-                for(l = 0; l<8; l++){
-                    // go through every bit in the row and check if its 1
-                    if(row & (0x80>>l)){
-                        // set the graphic buffer to 0 when font rom data shows 1
-                        buffer[(j*320+320)+ i*8+l] = 0; // j*320 is the row offset + 320 , i+8+l is the column offset 
-                    }
-                }
-            }
-        }
-
-        // inputs the right side input
-        int typed_length= strlen(input); // length of the user input
-        char underscore = '_';
-        int underscore_enabled = 0;
-        if(typed_length<20){
-            typed_length+=1;
-            underscore_enabled = 1;
-        }
-        // goes through the rows of the status bar 
-        for(j=0; j<18;j++){
-            // if(j<=1 || j>=16) continue;
-            // goes through the string in order for it to be added to the graphic buffer
-            for(i = 0; i<strlen(input); i++ ){
-                 // get the ascii value of the character from the string
-                int ascii = input[i];
-                // get the row of ascii character from the font rom 
-                char row = font_data[ascii][j];
-                // go through the row of the ascii character 
-                for(l = 0; l<8; l++){
-                    // go through every bit in the row and check if its 1
-                    if(row & (0x80>>l)){
-                        int row_offset = j*320 + 320 ;  // row offset is set 320 is column size +320 for the skipped row to align
-                        int char_col_offset = i*8; // column offset due to the string character position in the string 
-                        buffer[row_offset+ char_col_offset + (320-(typed_length*8))+l] = 0; // 320 - (typed_length*8) gives the starting point from the left side 
-                    }
-                }
-            }
-        }
-        if(underscore_enabled){
-            for(j=0; j<18;j++){
-            // if(j<=1 || j>=16) continue;
-            // goes through the string in order for it to be added to the graphic buffer
-                    int ascii = underscore;
-                    // get the row of ascii character from the font rom 
-                    char row = font_data[ascii][j];
-                    // go through the row of the ascii character 
-                    for(l = 0; l<8; l++){
-                        // go through every bit in the row and check if its 1
-                        if(row & (0x80>>l)){
-                            int row_offset = j*320 + 320 ;  // row offset is set 320 is column size +320 for the skipped row to align
-                            buffer[row_offset + (320-(8))+l] = 0; // 320 - (typed_length*8) gives the starting point from the left side 
-                        }
-                    }
-                
-            }
-        }
+
+    /* 
+     * Write the cells that have changed, looking up the two bytes that
+     * each row of a cell puts into each plane.
+     */
+    if (!cell_planes_set)
+	set_cell_planes ();
+    for (y = 0; y < STATUS_ROWS; y++) {
+	for (x = 0; x < STATUS_CELLS; x++) {
+	    if (buf == last_buf && cells[y][x] == last_cells[y][x])
+		continue;
+	    addr = buf + y * (STATUS_X_DIM / 4) + x * (FONT_WIDTH / 4);
+	    px = cell_planes[cells[y][x]];
+	    for (p = 0; p < 4; p++) {
+		addr[p * STATUS_BAR_PLANE] = px[p][0];
+		addr[p * STATUS_BAR_PLANE + 1] = px[p][1];
+	    }
+	    changed++;
+	}
     }
-    // when the status message is populated
-    else{
-        // goes through the rows of the status bar
-        for(j=0; j<18;j++){
-            int status_length = strlen(status_msg); // length of the status message 
-            float offset = (40-status_length)/2;    // offset from the end of the status bar to position the user input string
-
-            // checks the length is even to see message is even to center is differently
-            if(status_length%2==0){
-                // goes through the string of status message 
-                for(i = 0; i<strlen(status_msg); i++ ){
-                    // get the ascii value of the character from the string
-                    int ascii = status_msg[i];
-                    // get the row of ascii character from the font rom 
-                    char row = font_data[ascii][j];
-                    // go through the row of the ascii character
-                    for(l = 0; l<8; l++){
-                        // go through every bit in the row and check if its 1
-                        if(row & (0x80>>l)){
-                            // the text graphic buffer is set to 0 
-                            buffer[(j*320+320)+ i*8+l+(int)offset*8] = 0; // (320*j+320) is the row offset, i*8*l is the column offset 
-                                                                          // offset is column offset for an even string 
-                        }
-                    }
-                }
-            }
-            // the length is even to see message is odd to center is differently
-            else{
-                // goes through the string of status message
-                for(i = 0; i<strlen(status_msg); i++ ){
-                    // get the ascii value of the character from the string
-                    int ascii = status_msg[i];
-                     // get the row of ascii character from the font rom 
-                    char row = font_data[ascii][j];
-                    // go through the row of the ascii character
-                    for(l = 0; l<8; l++){
-                        // go through every bit in the row and check if its 1
-                        if(row & (0x80>>l)){
-                            // the text graphic buffer is set to 0 
-                            buffer[j*320+ i*8+l+(int)offset*8 + 4] = 0; // offset*8 + 4 calculates the column offset due to the status message
-                                                                        // being odd 
-                        }
-                    }
-                }
-            }
-        }
+    (void)memcpy (last_cells, cells, sizeof (cells));
+    last_buf = buf;
+    return changed;
+}
+
+
+/*
+ * same_text
+ *   DESCRIPTION: Check whether a string is the same as the one remembered,
+ *                then remember the new one.  Strings too long to be 
+ *                remembered never match.
+ *   INPUTS: last -- the string remembered
+ *           s -- the new string
+ *   OUTPUTS: last -- the new string
+ *   RETURN VALUE: 1 if the strings match, or 0 if not
+ *   SIDE EFFECTS: none
+ */
+static int
+same_text (status_text_t* last, const char* s)
+{
+    int len = strlen (s); /* length of new string */
+
+    if (len > STATUS_TEXT_MAX) {
+	last->fits = 0;
+	return 0;
     }
+    if (last->fits && memcmp (last->s, s, len + 1) == 0)
+	return 1;
+    (void)memcpy (last->s, s, len + 1);
+    last->fits = 1;
+    return 0;
+}
+
+
+/*
+ * place_text
+ *   DESCRIPTION: Add the bits of a string's characters to the status bar
+ *                cells.  Each character may start halfway through a 
+ *                cell, in which case it covers two cells.  The bits of
+ *                characters that overlap are combined, and bits outside 
+ *                of the status bar (or in its bottom row) are dropped.
+ *   INPUTS: cells -- bits of each cell so far
+ *           s -- the string
+ *           x -- pixel column of first character (a multiple of 4)
+ *           y -- pixel row of top of characters
+ *   OUTPUTS: cells -- bits with the string added
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+place_text (unsigned char cells[STATUS_ROWS][STATUS_CELLS], const char* s, 
+	    int x, int y)
+{
+    const unsigned char* glyph; /* font rows of a character        */
+    int cell;                   /* cell holding left of character  */
+    int shift;                  /* pixels of character in cell     */
+    int r;                      /* loop index over rows of font    */
 
-    // loop through the last pixel row of the status bar and makes it the background color just incase
-    for(i=17*320; i<18*320;i++){
-        buffer[i]=1;
+    for (; *s != '\0'; s++, x += FONT_WIDTH) {
+	glyph = font_data[(unsigned char)*s];
+	cell = (x >> 3);
+	shift = (x & 7);
+	for (r = 0; r < FONT_HEIGHT && y + r < STATUS_ROWS - 1; r++) {
+	    if (cell >= 0 && cell < STATUS_CELLS)
+		cells[y + r][cell] |= (glyph[r] >> shift);
+	    if (shift != 0 && cell + 1 >= 0 && cell + 1 < STATUS_CELLS)
+		cells[y + r][cell + 1] |= (glyph[r] << (FONT_WIDTH - shift));
+	}
     }
+}
+
+
+/*
+ * set_cell_planes
+ *   DESCRIPTION: Fill the table of planar images of cell rows.  Pixels 
+ *                with x mod 4 equal to p go into plane p, so each plane 
+ *                holds two pixels of a cell row.  Bits that are set are
+ *                drawn in the text color, others in the background color.
+ *                The table is indexed by the bits of a cell row rather 
+ *                than by character, since a cell row can combine the 
+ *                bits of two characters.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: fills cell_planes
+ */
+static void
+set_cell_planes ()
+{
+    int bits; /* loop index over patterns of bits */
+    int l;    /* loop index over pixels in a row */
+
+    for (bits = 0; bits < 256; bits++)
+	for (l = 0; l < FONT_WIDTH; l++)
+	    cell_planes[bits][l & 3][l >> 2] = 
+		((bits & (0x80 >> l)) ? STATUS_TEXT_COLOR : STATUS_BACK_COLOR);
+    cell_planes_set = 1;
+}
+
+
+#if defined(TEXT_BENCHMARK)
+
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * The code below replaces the game with a benchmark of setting up the 
+ * status bar image for a status message as wide as the status bar.  
+ * Images are set up alternately in two buffers, so that every cell is
+ * written each time.  The images are compared with those written pixel
+ * by pixel (as by the original loop, kept below as write_cells_bytes), 
+ * and the time per image is reported for each.
+ */
+
+#define BENCH_REPS 20000 /* images set up for timing */
+
 
-    // sets the plane buffer for the status bar from the graphic buffer
-    for(i=0;i<STATUS_BAR_PLANE;i++){
-        // iterates through the pixels: 0,1,2,3 in order to be put into the planar buffer 
-        for(j=0;j<4;j++){
-            // checks if the status bar graphic buffer is 1
-            if(buffer[i*4+j]==0){
-                buf[STATUS_BAR_PLANE*j+i]= 0x20; // sets the character to a color red 
-            }
-            else{
-                buf[STATUS_BAR_PLANE*j+i]= 0x05; // sets the background to a color teal
-            }
-        }
+/*
+ * write_cells_bytes
+ *   DESCRIPTION: Set up the status bar image for a status message one 
+ *                pixel at a time, without the table of cell rows.
+ *   INPUTS: msg -- the status message (of even length)
+ *   OUTPUTS: buf -- the image
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+write_cells_bytes (const char* msg, unsigned char* buf)
+{
+    unsigned char cells[STATUS_ROWS][STATUS_CELLS]; /* bits of each cell */
+    unsigned char* addr;   /* first pixel of a cell in plane 0           */
+    int x, y;              /* loop indices over cells and rows           */
+    int l;                 /* loop index over pixels in a cell           */
+
+    (void)memset (cells, 0, sizeof (cells));
+    place_text (cells, msg, (STATUS_CELLS - (int)strlen (msg)) / 2 * 
+		FONT_WIDTH, 1);
+    for (y = 0; y < STATUS_ROWS; y++) {
+	for (x = 0; x < STATUS_CELLS; x++) {
+	    addr = buf + y * (STATUS_X_DIM / 4) + x * (FONT_WIDTH / 4);
+	    for (l = 0; l < FONT_WIDTH; l++)
+		addr[(l & 3) * STATUS_BAR_PLANE + (l >> 2)] = 
+		    ((cells[y][x] & (0x80 >> l)) ? STATUS_TEXT_COLOR : 
+		     STATUS_BACK_COLOR);
+	}
     }
 }
 
 
+/* 
+ * elapsed_us
+ *   DESCRIPTION: Calculate the time between two clock readings.
+ *   INPUTS: start -- earlier reading
+ *           end -- later reading
+ *   OUTPUTS: none
+ *   RETURN VALUE: elapsed time in microseconds
+ *   SIDE EFFECTS: none
+ */   
+static double
+elapsed_us (const struct timespec* start, const struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e6 + 
+	   (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+
+/*
+ * main -- for the "textbench" program
+ *   DESCRIPTION: Check and time setting up the status bar image.
+ *   INPUTS: none (command line arguments are ignored)
+ *   OUTPUTS: prints one line of results
+ *   RETURN VALUE: 0 if the images match, 3 otherwise
+ */   
+int
+main ()
+{
+    /* status message as wide as the status bar */
+    static const char msg[STATUS_CELLS + 1] = 
+	"You can't go that way--the door's locked";
+    static unsigned char img[2][STATUS_BAR_PLANE * 4]; /* images set up */
+    static unsigned char want[STATUS_BAR_PLANE * 4];   /* pixel by pixel */
+    struct timespec t0, t1; /* clock readings             */
+    double bytes_us;        /* time per image, pixel loop */
+    double us;              /* time per image, table      */
+    int changed = 0;        /* cells written per image    */
+    int ok;                 /* images match?              */
+    int rep;                /* index over images          */
+
+    write_cells_bytes (msg, want);
+    for (ok = 1, rep = 0; rep < 2; rep++) {
+	changed = set_text_to_buffer ("", "", msg, img[rep]);
+	ok = ok && (memcmp (want, img[rep], sizeof (want)) == 0);
+    }
+    ok = ok && (set_text_to_buffer ("", "", msg, img[1]) == 0);
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &t0);
+    for (rep = 0; rep < BENCH_REPS; rep++)
+	write_cells_bytes (msg, img[rep & 1]);
+    (void)clock_gettime (CLOCK_MONOTONIC, &t1);
+    bytes_us = elapsed_us (&t0, &t1) / BENCH_REPS;
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &t0);
+    for (rep = 0; rep < BENCH_REPS; rep++)
+	(void)set_text_to_buffer ("", "", msg, img[rep & 1]);
+    (void)clock_gettime (CLOCK_MONOTONIC, &t1);
+    us = elapsed_us (&t0, &t1) / BENCH_REPS;
+
+    printf ("status line %d chars, %d cells  pixels %6.2f us  "
+	    "table %6.2f us  %5.1fx  %s\n", (int)strlen (msg), changed, 
+	    bytes_us, us, bytes_us / us, (ok ? "identical" : "MISMATCH"));
+    return (ok ? 0 : 3);
+}
+
+#endif /* defined(TEXT_BENCHMARK) */
@@ -42,7 +42,12 @@
 
 /* Standard VGA text font. */
 extern unsigned char font_data[256][16];
-/*function that converts the strings into graphics and sets up the plane buffer to be mapped onto the VGA memory*/
-void set_text_to_buffer(const char *string,const char *input, const char * status_msg, unsigned char *buf);
+/*
+ * set up the planar status bar image in buf for the location name, typed
+ * text, and status message; returns the number of 8-pixel cells changed 
+ * since the last call with the same buffer (0 if the strings are the same)
+ */
+extern int set_text_to_buffer (const char* string, const char* input, 
+			       const char* status_msg, unsigned char* buf);
 
 #endif /* TEXT_H */
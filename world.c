@@ -34,8 +34,10 @@
  */
  
 
+#include <pthread.h>
 #include <string.h>
 #include <strings.h>
+#include <unistd.h>
 
 #include "assert.h"
 #include "photo.h"
@@ -163,6 +165,37 @@ enum {
     NUM_FLAGS
 };
 
+/*
+ * Number of threads used by build_world to read room photos and object
+ * images.  Zero uses one thread per online processor; one reads all
+ * files serially in the calling thread.
+ */
+#if !defined(WORLD_LOAD_THREADS)
+#define WORLD_LOAD_THREADS 0
+#endif
+
+/*
+ * Bytes of room photo pixel data kept in memory.  Zero (the default)
+ * reads every room photo in build_world and keeps them all; otherwise,
+ * each photo is read when first needed, and the least recently used
+ * photos are released once the total exceeds the budget.
+ */
+#if !defined(WORLD_PHOTO_BUDGET)
+#define WORLD_PHOTO_BUDGET 0
+#endif
+
+/* maximum number of photos waiting to be read by the prefetch thread */
+#define PREFETCH_QUEUE 8
+
+/* 
+ * Each room indexes its objects by the bands of rows and of columns of 
+ * the room photo that they cover; OBJ_BAND is the size of a band in 
+ * pixels.  Objects are recorded in bit masks, so every object must fit.
+ */
+#define OBJ_BAND    32
+#define N_ROW_BANDS ((MAX_PHOTO_HEIGHT + OBJ_BAND - 1) / OBJ_BAND)
+#define N_COL_BANDS ((MAX_PHOTO_WIDTH + OBJ_BAND - 1) / OBJ_BAND)
+
 /* identifiers for rooms with photo swapping */
 enum {
     SWAP_CIRCLE,	/* Boneyard Creek Bridge photo swap */
@@ -173,17 +206,41 @@ enum {
 
 /* types local to this file (declared in types.h) */
 
+/*
+ * A room photo that may or may not be in memory.  The size is read from
+ * the file when the world is built, so that objects can be placed and
+ * scrolling limits found without decoding the photo.  Photos in memory
+ * are kept on a list in order of use, most recent first.  All fields but
+ * filename are protected by photo_lock.
+ */
+typedef struct photo_slot_t photo_slot_t;
+struct photo_slot_t {
+    const char*    filename;	/* file name for photo            */
+    photo_t*       photo;	/* the photo, or NULL if not read */
+    photo_header_t hdr;		/* photo height and width         */
+    photo_slot_t*  newer;	/* more recently used photo       */
+    photo_slot_t*  older;	/* less recently used photo       */
+    int32_t        loading;	/* is photo being read right now? */
+};
+
 /*
  * The structure representing a room in the world.  The backpack/inventory 
- * is also a 'room' (#0, R_INVENTORY). 
+ * is also a 'room' (#0, R_INVENTORY).  The object index is rebuilt by
+ * index_room whenever the contents change: objs holds the contents in
+ * list order, and bit i of row_objs[b] (col_objs[b]) is set when objs[i]
+ * covers any row (column) in band b.
  */
 struct room_t {
-    const char* name;		/* name of room                   */
-    photo_t*    view;		/* photo currently shown for room */
-    object_t*   contents; 	/* linked list of objects in room */
-    room_t*     left;   	/* room to the "left"             */
-    room_t*     enter;  	/* doors, etc.                    */
-    room_t*     right;  	/* room to the "right"            */
+    const char*   name;		/* name of room                   */
+    photo_slot_t* view;		/* photo currently shown for room */
+    object_t*     contents; 	/* linked list of objects in room */
+    room_t*       left;   	/* room to the "left"             */
+    room_t*       enter;  	/* doors, etc.                    */
+    room_t*       right;  	/* room to the "right"            */
+    int32_t       n_objs;	/* number of objects in room      */
+    object_t*     objs[MAX_ROOM_OBJECTS]; /* objects in list order */
+    uint32_t      row_objs[N_ROW_BANDS];  /* objects in row bands  */
+    uint32_t      col_objs[N_COL_BANDS];  /* objects in col bands  */
 };
 
 /*
@@ -404,9 +461,9 @@ static const obj_data_t obj_data[N_OBJECTS] = {
 };
 
 /*
- * Some rooms alternate between two photos.  For these rooms, we load the
- * image data for both photos once, but need an extra pointer in order to
- * keep track of the photo currently swapped out.  We use these swap data
+ * Some rooms alternate between two photos.  For these rooms, we need an
+ * extra photo slot in order to keep track of the photo currently swapped
+ * out.  We use these swap data
  * to name and describe these extra photos.
  */
 typedef struct swap_data_t swap_data_t;
@@ -421,17 +478,72 @@ static const swap_data_t swap_data[N_SWAPS] = {
     {SWAP_CAR, "images/caropen.photo"}		/* open/closed car photos */
 };
 
+/*
+ * Rooms that can be reached from a room other than by moving left, 
+ * entering, or moving right (doors that need an Icard, driving, and so
+ * forth).  Used only to choose photos to prefetch.
+ */
+typedef struct exit_data_t exit_data_t;
+struct exit_data_t {
+    int32_t from;	/* id of room with special exit */
+    int32_t to;		/* id of room reached           */
+};
+
+static const exit_data_t extra_exits[] = {
+    {R_BY_CLEANR, R_IN_CLEANR},		/* wearing a bunnysuit */
+    {R_BY_395LAB, R_IN_395LAB},		/* swiping an Icard    */
+    {R_CSL_DOOR, R_CSL_LOBBY},		/* swiping an Icard    */
+    {R_BECK_DOOR, R_BECKLOBBY},		/* picking the lock    */
+    {R_CAR_SITE, R_ALLERTON},		/* driving             */
+    {R_CAR_SITE, R_WILLARD},
+    {R_ALLERTON, R_WILLARD},
+    {R_ALLERTON, R_CAR_SITE},
+    {R_WILLARD, R_CAR_SITE}
+};
+
+
+/*
+ * All image files read by build_world are described by a single table of
+ * load jobs so that they can be handed out to a pool of worker threads.
+ * Jobs are numbered with the room photos first, then the object images,
+ * then the swap photos, each in the order of the corresponding data array.
+ */
+#define JOB_OBJECT_BASE N_ROOMS
+#define JOB_SWAP_BASE   (N_ROOMS + N_OBJECTS)
+#define N_LOAD_JOBS     (N_ROOMS + N_OBJECTS + N_SWAPS)
+
+typedef struct load_pool_t load_pool_t;
+struct load_pool_t {
+    pthread_mutex_t lock;		/* protects next_job          */
+    int32_t         next_job;		/* next job to be handed out  */
+    void*           result[N_LOAD_JOBS]; /* photo_t* or image_t* read */
+};
+
 
 /* functions local to this file--see function headers for details */
+static void add_prefetch (photo_slot_t* s);
 static void do_photo_swap (room_t* r, int32_t which);
+static void evict_photos (const photo_slot_t* keep);
 static object_t* find_in_room (const room_t* r, const char* arg);
+static void index_room (room_t* r);
 static void insert_object_at (object_t* o, room_t* r, int32_t x, int32_t y);
 static void insert_object (object_t* o, room_t* r);
+static void link_photo (photo_slot_t* s);
+static photo_t* load_photo (photo_slot_t* s);
+static void load_all_images (load_pool_t* pool);
+static void* load_worker (void* arg);
 static void move_object_to_inventory (object_t* obj);
+static int32_t objects_in_mask (const room_t* r, uint32_t mask, 
+				object_t* objs[MAX_ROOM_OBJECTS]);
 static object_t* obj_special_get (room_t* r, const char* arg);
 static int32_t player_flag_is_set (int32_t fnum);
 static void player_set_flag (int32_t fnum);
+static void* prefetch_worker (void* arg);
+static void release_photo (photo_slot_t* s);
 static void remove_object (object_t* o);
+static int32_t set_up_slot (photo_slot_t* s, const char* fname, 
+			    photo_t* p);
+static void unlink_photo (photo_slot_t* s);
 
 
 /* file-scope variables */
@@ -443,7 +555,67 @@ static void remove_object (object_t* o);
 static room_t   room[N_ROOMS];			     /* rooms                */
 static object_t object[N_OBJECTS];		     /* objects              */
 static uint32_t player_flags[(NUM_FLAGS + 31) / 32]; /* accomplishment flags */
-static photo_t* swap_photo[N_SWAPS];                 /* swapping photos      */
+static photo_slot_t* swap_photo[N_SWAPS];            /* swapping photos      */
+static int32_t  load_threads = WORLD_LOAD_THREADS;   /* build_world threads  */
+
+/* 
+ * Room photos, which may be read on demand.  Slots for the rooms come 
+ * first, followed by those for the swap photos, each in the order of the
+ * corresponding data array.
+ */
+static photo_slot_t  photo_slot[N_ROOMS + N_SWAPS]; /* all photo slots   */
+static photo_slot_t* newest_photo = NULL;  /* most recently used photo   */
+static photo_slot_t* oldest_photo = NULL;  /* least recently used photo  */
+static size_t        photo_bytes = 0;      /* photo pixel data in memory */
+static size_t        photo_budget = WORLD_PHOTO_BUDGET; /* limit on bytes */
+
+/* 
+ * The slot of the photo last returned by room_photo, which is never 
+ * released, since the caller may still be using the photo.
+ */
+static photo_slot_t* pinned_photo = NULL;
+
+/* 
+ * Room photos may be read either by the game (in room_photo) or by a 
+ * prefetch thread started by world_prefetch_neighbors, which reads the
+ * photos queued for it in order.  The photo slots, the list of photos 
+ * in memory, and the queue are protected by photo_lock; photo_ready is
+ * signalled whenever a slot finishes loading, and prefetch_wake whenever
+ * the queue is refilled.
+ */
+static pthread_mutex_t photo_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  photo_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  prefetch_wake = PTHREAD_COND_INITIALIZER;
+static photo_slot_t*   prefetch_queue[PREFETCH_QUEUE]; /* photos to read */
+static int32_t         prefetch_count = 0;   /* photos in queue         */
+static int32_t         prefetch_started = 0; /* prefetch thread running? */
+
+
+/* 
+ * add_prefetch
+ *   DESCRIPTION: Add a photo to the prefetch queue unless it is already 
+ *                in memory, being read, or queued, or the queue is full.
+ *                Must be called with photo_lock held.
+ *   INPUTS: s -- the photo slot
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the prefetch queue
+ */
+static void
+add_prefetch (photo_slot_t* s)
+{
+    int32_t i;	/* index over queue */
+
+    if (NULL != s->photo || s->loading || PREFETCH_QUEUE <= prefetch_count) {
+        return;
+    }
+    for (i = 0; prefetch_count > i; i++) {
+        if (s == prefetch_queue[i]) {
+	    return;
+	}
+    }
+    prefetch_queue[prefetch_count++] = s;
+}
 
 
 /* 
@@ -458,7 +630,7 @@ static photo_t* swap_photo[N_SWAPS];                 /* swapping photos      */
 static void
 do_photo_swap (room_t* r, int32_t which)
 {
-    photo_t* tmp;	/* temporary variable to help with swap */
+    photo_slot_t* tmp;	/* temporary variable to help with swap */
 
     /* Swap the photos. */
     tmp               = r->view;
@@ -467,6 +639,34 @@ do_photo_swap (room_t* r, int32_t which)
 }
 
 
+/* 
+ * evict_photos
+ *   DESCRIPTION: Release the least recently used room photos until the
+ *                photos in memory fit within the budget.  The photo in
+ *                slot keep and the pinned photo are never released, even
+ *                if they alone exceed the budget.  Must be called with
+ *                photo_lock held.
+ *   INPUTS: keep -- slot holding the photo just read or used
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees photo data
+ */
+static void
+evict_photos (const photo_slot_t* keep)
+{
+    photo_slot_t* s;	/* photo being examined          */
+    photo_slot_t* next;	/* next more recently used photo */
+
+    for (s = oldest_photo; 0 != photo_budget && photo_budget < photo_bytes &&
+	 NULL != s; s = next) {
+	next = s->newer;
+	if (keep != s && pinned_photo != s) {
+	    release_photo (s);
+	}
+    }
+}
+
+
 /* 
  * find_in_room
  *   DESCRIPTION: Find an object by name in a room.  The name must match
@@ -496,6 +696,50 @@ find_in_room (const room_t* r, const char* arg)
 }
 
 
+/* 
+ * index_room
+ *   DESCRIPTION: Rebuild the object index of a room from its contents.
+ *   INPUTS: r -- the room
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the room's object index
+ */
+static void
+index_room (room_t* r)
+{
+    object_t* obj;	/* index over room contents      */
+    uint32_t  bit;	/* mask bit for object           */
+    int32_t   first;	/* first band covered by object  */
+    int32_t   last;	/* last band covered by object   */
+
+    (void)memset (r->row_objs, 0, sizeof (r->row_objs));
+    (void)memset (r->col_objs, 0, sizeof (r->col_objs));
+    for (r->n_objs = 0, obj = r->contents; NULL != obj; 
+    	 obj = obj->next, r->n_objs++) {
+	r->objs[r->n_objs] = obj;
+	bit = (1UL << r->n_objs);
+
+	first = obj->y / OBJ_BAND;
+	last = (obj->y + image_height (obj->img) - 1) / OBJ_BAND;
+	if (N_ROW_BANDS <= last) {
+	    last = N_ROW_BANDS - 1;
+	}
+	for (; last >= first; first++) {
+	    r->row_objs[first] |= bit;
+	}
+
+	first = obj->x / OBJ_BAND;
+	last = (obj->x + image_width (obj->img) - 1) / OBJ_BAND;
+	if (N_COL_BANDS <= last) {
+	    last = N_COL_BANDS - 1;
+	}
+	for (; last >= first; first++) {
+	    r->col_objs[first] |= bit;
+	}
+    }
+}
+
+
 /* 
  * insert_object_at
  *   DESCRIPTION: Place an object at a specific (x,y) location in a room.
@@ -523,6 +767,7 @@ insert_object_at (object_t* o, room_t* r, int32_t x, int32_t y)
     o->loc = r;
     o->next = r->contents;
     r->contents = o;
+    index_room (r);
 }
 
 
@@ -548,11 +793,11 @@ insert_object (object_t* o, room_t* r)
 
 
     /* Choose a random x location. */
-    range = photo_width (r->view) - image_width (o->img);
+    range = room_photo_width (r) - image_width (o->img);
     xpos = (0 >= range ? 0 : (rand () % range));
 
     /* Place in the lowest quarter of the roo photo if the object fits... */
-    space = photo_height (r->view);
+    space = room_photo_height (r);
     img_ht = image_height (o->img);
     range = space / 4 - img_ht;
     if (0 >= range) {
@@ -568,6 +813,170 @@ insert_object (object_t* o, room_t* r)
 }
 
 
+/* 
+ * link_photo
+ *   DESCRIPTION: Put a photo slot at the most recently used end of the
+ *                list of photos in memory.
+ *   INPUTS: s -- the slot (not on the list)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the list of photos in memory
+ */
+static void
+link_photo (photo_slot_t* s)
+{
+    s->newer = NULL;
+    s->older = newest_photo;
+    if (NULL != newest_photo) {
+        newest_photo->newer = s;
+    } else {
+        oldest_photo = s;
+    }
+    newest_photo = s;
+}
+
+
+/* 
+ * load_photo
+ *   DESCRIPTION: Make sure that a room photo is in memory, reading it if
+ *                necessary, and mark it as the most recently used photo.
+ *                If the photo is already being read by another thread, 
+ *                waits for that thread to finish rather than reading it
+ *                again.  Must be called with photo_lock held; the lock 
+ *                is released while the photo is read.
+ *   INPUTS: s -- the photo slot
+ *   OUTPUTS: none
+ *   RETURN VALUE: the photo, or NULL if it can't be read
+ *   SIDE EFFECTS: may read the photo and release other photos
+ */
+static photo_t*
+load_photo (photo_slot_t* s)
+{
+    photo_t* p;	/* photo read */
+
+    while (s->loading) {
+        (void)pthread_cond_wait (&photo_ready, &photo_lock);
+    }
+    if (NULL != s->photo) {
+	if (newest_photo != s) {
+	    unlink_photo (s);
+	    link_photo (s);
+	}
+	return s->photo;
+    }
+
+    s->loading = 1;
+    (void)pthread_mutex_unlock (&photo_lock);
+    p = read_photo (s->filename);
+    (void)pthread_mutex_lock (&photo_lock);
+    s->loading = 0;
+    (void)pthread_cond_broadcast (&photo_ready);
+    if (NULL != p) {
+	s->photo = p;
+	photo_bytes += s->hdr.width * s->hdr.height;
+	link_photo (s);
+	evict_photos (s);
+    }
+    return p;
+}
+
+
+/* 
+ * load_worker
+ *   DESCRIPTION: Thread body for reading image files.  Repeatedly takes 
+ *                the next unclaimed job from the pool and reads the room 
+ *                photo or object image that it names, until no jobs are 
+ *                left.
+ *   INPUTS: arg -- pointer to the load pool
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: fills in result entries of the pool
+ */
+static void*
+load_worker (void* arg)
+{
+    load_pool_t* pool = arg; /* shared job pool       */
+    int32_t      job;        /* job claimed by thread */
+
+    while (1) {
+	(void)pthread_mutex_lock (&pool->lock);
+	job = pool->next_job++;
+	(void)pthread_mutex_unlock (&pool->lock);
+	if (N_LOAD_JOBS <= job) {
+	    return NULL;
+	}
+
+	/* 
+	 * Each job writes only its own result slot.  Room photos are read
+	 * here only if they are all to be kept in memory.
+	 */
+	if (JOB_SWAP_BASE <= job) {
+	    if (0 != photo_budget) {
+	        continue;
+	    }
+	    pool->result[job] = 
+		    read_photo (swap_data[job - JOB_SWAP_BASE].filename);
+	} else if (JOB_OBJECT_BASE <= job) {
+	    pool->result[job] = 
+		    read_obj_image (obj_data[job - JOB_OBJECT_BASE].filename);
+	} else if (0 == photo_budget) {
+	    pool->result[job] = read_photo (room_data[job].filename);
+	}
+    }
+}
+
+
+/* 
+ * load_all_images
+ *   DESCRIPTION: Read every object image named in the data arrays, as
+ *                well as every room photo and swap photo if the photos
+ *                are not read on demand, fanning the work out over
+ *                load_threads worker threads and waiting for all of them
+ *                to finish.  Failures are recorded as NULL results and
+ *                are reported by the caller.
+ *   INPUTS: none
+ *   OUTPUTS: pool -- results of all load jobs
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: dynamically allocates memory for the images
+ */
+static void
+load_all_images (load_pool_t* pool)
+{
+    pthread_t tid[N_LOAD_JOBS]; /* worker thread ids               */
+    int32_t   n_threads;        /* number of workers to run        */
+    int32_t   n_started;        /* number of workers started       */
+
+    (void)pthread_mutex_init (&pool->lock, NULL);
+    pool->next_job = 0;
+    (void)memset (pool->result, 0, sizeof (pool->result));
+
+    /* Pick the number of threads: one per processor unless specified. */
+    n_threads = load_threads;
+    if (0 >= n_threads) {
+        n_threads = sysconf (_SC_NPROCESSORS_ONLN);
+    }
+    if (N_LOAD_JOBS < n_threads) {
+        n_threads = N_LOAD_JOBS;
+    }
+
+    /* 
+     * The calling thread always works too, so we start one fewer thread.
+     * If a thread can't be created, the remaining threads (at worst, just
+     * the caller) simply pick up its share of the jobs.
+     */
+    for (n_started = 0; n_threads - 1 > n_started; n_started++) {
+        if (0 != pthread_create (&tid[n_started], NULL, load_worker, pool)) {
+	    break;
+	}
+    }
+    (void)load_worker (pool);
+    while (0 < n_started--) {
+        (void)pthread_join (tid[n_started], NULL);
+    }
+    (void)pthread_mutex_destroy (&pool->lock);
+}
+
+
 /* 
  * move_object_to_inventory
  *   DESCRIPTION: Move an object into the player's inventory.  Try to 
@@ -609,6 +1018,29 @@ move_object_to_inventory (object_t* obj)
 }
 
 
+/* 
+ * objects_in_mask
+ *   DESCRIPTION: List the objects of a room that are selected by a mask
+ *                from its object index, in list order.
+ *   INPUTS: r -- the room
+ *           mask -- bit i selects object i of the index
+ *   OUTPUTS: objs -- the objects selected
+ *   RETURN VALUE: number of objects selected
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+objects_in_mask (const room_t* r, uint32_t mask, 
+		 object_t* objs[MAX_ROOM_OBJECTS])
+{
+    int32_t n; /* number of objects selected */
+
+    for (n = 0; 0 != mask; mask &= mask - 1) {
+        objs[n++] = r->objs[__builtin_ctz (mask)];
+    }
+    return n;
+}
+
+
 /* 
  * obj_special_get
  *   DESCRIPTION: Handle special effects "get" commands, in which a player
@@ -681,6 +1113,56 @@ player_set_flag (int32_t fnum)
 }
 
 
+/* 
+ * prefetch_worker
+ *   DESCRIPTION: Thread body for prefetching room photos.  Repeatedly 
+ *                takes the first photo from the prefetch queue and reads
+ *                it, sleeping while the queue is empty.  Photos that 
+ *                can't be read are left for room_photo to report.
+ *   INPUTS: arg -- ignored
+ *   OUTPUTS: none
+ *   RETURN VALUE: never returns
+ *   SIDE EFFECTS: reads photos and releases other photos
+ */
+static void*
+prefetch_worker (void* arg)
+{
+    photo_slot_t* s;	/* photo being read */
+
+    (void)pthread_mutex_lock (&photo_lock);
+    while (1) {
+        while (0 == prefetch_count) {
+	    (void)pthread_cond_wait (&prefetch_wake, &photo_lock);
+	}
+	s = prefetch_queue[0];
+	(void)memmove (&prefetch_queue[0], &prefetch_queue[1],
+		       --prefetch_count * sizeof (prefetch_queue[0]));
+	(void)load_photo (s);
+    }
+    return NULL;
+}
+
+
+/* 
+ * release_photo
+ *   DESCRIPTION: Free the photo held in a slot.  The slot keeps the 
+ *                photo's size and file name, so the photo can be read
+ *                again when next needed.
+ *   INPUTS: s -- the slot (holding a photo)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees photo data; changes the list of photos in memory
+ */
+static void
+release_photo (photo_slot_t* s)
+{
+    unlink_photo (s);
+    free_photo (s->photo);
+    s->photo = NULL;
+    photo_bytes -= s->hdr.width * s->hdr.height;
+}
+
+
 /* 
  * remove_object
  *   DESCRIPTION: Take an object out of its current location, leaving it
@@ -708,11 +1190,68 @@ remove_object (object_t* o)
 	}
 
 	/* Mark the object's location as NULL. */
+	index_room (o->loc);
 	o->loc = NULL;
     }
 }
 
 
+/* 
+ * set_up_slot
+ *   DESCRIPTION: Prepare a photo slot, either with a photo that has 
+ *                already been read or, if the photo is to be read on
+ *                demand, with just the size of the photo.
+ *   INPUTS: s -- the slot
+ *           fname -- file name for photo
+ *           p -- the photo, or NULL if it has not been read
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 on success, or 0 if the photo can't be read
+ *   SIDE EFFECTS: changes the list of photos in memory
+ */
+static int32_t
+set_up_slot (photo_slot_t* s, const char* fname, photo_t* p)
+{
+    s->filename = fname;
+    s->photo = p;
+    s->newer = s->older = NULL;
+    s->loading = 0;
+    if (NULL == p) {
+	/* Without a budget, all photos must already have been read. */
+	return (0 != photo_budget && read_photo_size (fname, &s->hdr));
+    }
+    s->hdr.width = photo_width (p);
+    s->hdr.height = photo_height (p);
+    photo_bytes += s->hdr.width * s->hdr.height;
+    link_photo (s);
+    return 1;
+}
+
+
+/* 
+ * unlink_photo
+ *   DESCRIPTION: Take a photo slot off of the list of photos in memory.
+ *   INPUTS: s -- the slot (on the list)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the list of photos in memory
+ */
+static void
+unlink_photo (photo_slot_t* s)
+{
+    if (NULL != s->newer) {
+        s->newer->older = s->older;
+    } else {
+        newest_photo = s->older;
+    }
+    if (NULL != s->older) {
+        s->older->newer = s->newer;
+    } else {
+        oldest_photo = s->newer;
+    }
+    s->newer = s->older = NULL;
+}
+
+
 /* 
  * obj_get_x
  *   DESCRIPTION: Get x position of object within containing room.
@@ -806,18 +1345,148 @@ room_name (const room_t* r)
 }
 
 
+/* 
+ * room_objects_in_cols
+ *   DESCRIPTION: Find the objects in a room that may cover any of a range
+ *                of columns of the room photo.  Every object that covers
+ *                one of the columns is included, but some that do not 
+ *                may be included as well.
+ *   INPUTS: r -- pointer to the room
+ *           x -- the first column
+ *           width -- number of columns
+ *   OUTPUTS: objs -- the objects, in the order given by 
+ *                    room_contents_iterate
+ *   RETURN VALUE: number of objects found
+ *   SIDE EFFECTS: none
+ */
+int32_t
+room_objects_in_cols (const room_t* r, int32_t x, int32_t width,
+		      object_t* objs[MAX_ROOM_OBJECTS])
+{
+    uint32_t mask = 0; /* objects in the bands covered */
+    int32_t  band;     /* index over bands covered     */
+    int32_t  last;     /* last band covered            */
+
+    band = (0 > x ? 0 : x / OBJ_BAND);
+    last = (x + width - 1) / OBJ_BAND;
+    if (N_COL_BANDS <= last) {
+        last = N_COL_BANDS - 1;
+    }
+    for (; 0 < width && last >= band; band++) {
+        mask |= r->col_objs[band];
+    }
+    return objects_in_mask (r, mask, objs);
+}
+
+
+/* 
+ * room_objects_in_rows
+ *   DESCRIPTION: Find the objects in a room that may cover any of a range
+ *                of rows of the room photo.  Every object that covers one
+ *                of the rows is included, but some that do not may be 
+ *                included as well.
+ *   INPUTS: r -- pointer to the room
+ *           y -- the first row
+ *           height -- number of rows
+ *   OUTPUTS: objs -- the objects, in the order given by 
+ *                    room_contents_iterate
+ *   RETURN VALUE: number of objects found
+ *   SIDE EFFECTS: none
+ */
+int32_t
+room_objects_in_rows (const room_t* r, int32_t y, int32_t height,
+		      object_t* objs[MAX_ROOM_OBJECTS])
+{
+    uint32_t mask = 0; /* objects in the bands covered */
+    int32_t  band;     /* index over bands covered     */
+    int32_t  last;     /* last band covered            */
+
+    band = (0 > y ? 0 : y / OBJ_BAND);
+    last = (y + height - 1) / OBJ_BAND;
+    if (N_ROW_BANDS <= last) {
+        last = N_ROW_BANDS - 1;
+    }
+    for (; 0 < height && last >= band; band++) {
+        mask |= r->row_objs[band];
+    }
+    return objects_in_mask (r, mask, objs);
+}
+
+
+/* 
+ * room_objects_on_col
+ *   DESCRIPTION: Find the objects in a room that may cover a column of
+ *                the room photo.  Every object that covers the column is
+ *                included, but some that do not may be included as well.
+ *   INPUTS: r -- pointer to the room
+ *           x -- the column
+ *   OUTPUTS: objs -- the objects, in the order given by 
+ *                    room_contents_iterate
+ *   RETURN VALUE: number of objects found
+ *   SIDE EFFECTS: none
+ */
+int32_t
+room_objects_on_col (const room_t* r, int32_t x, 
+		     object_t* objs[MAX_ROOM_OBJECTS])
+{
+    if (0 > x || N_COL_BANDS * OBJ_BAND <= x) {
+        return 0;
+    }
+    return objects_in_mask (r, r->col_objs[x / OBJ_BAND], objs);
+}
+
+
+/* 
+ * room_objects_on_row
+ *   DESCRIPTION: Find the objects in a room that may cover a row of the
+ *                room photo.  Every object that covers the row is 
+ *                included, but some that do not may be included as well.
+ *   INPUTS: r -- pointer to the room
+ *           y -- the row
+ *   OUTPUTS: objs -- the objects, in the order given by 
+ *                    room_contents_iterate
+ *   RETURN VALUE: number of objects found
+ *   SIDE EFFECTS: none
+ */
+int32_t
+room_objects_on_row (const room_t* r, int32_t y, 
+		     object_t* objs[MAX_ROOM_OBJECTS])
+{
+    if (0 > y || N_ROW_BANDS * OBJ_BAND <= y) {
+        return 0;
+    }
+    return objects_in_mask (r, r->row_objs[y / OBJ_BAND], objs);
+}
+
+
 /* 
  * room_photo
- *   DESCRIPTION: Get room photo for a room.
+ *   DESCRIPTION: Get room photo for a room, reading the photo if it is
+ *                not in memory (or waiting for the prefetch thread if
+ *                it is reading the photo).  The photo returned remains 
+ *                valid until the next call.
  *   INPUTS: r -- pointer to the room
  *   OUTPUTS: none
  *   RETURN VALUE: a pointer to room r's photo
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: may read the photo and release other photos; 
+ *                 terminates the program if the photo can't be read
  */
 photo_t*
 room_photo (const room_t* r)
 {
-    return r->view;
+    photo_slot_t* s = r->view; /* slot for room's photo */
+    photo_t*      p;           /* the photo            */
+
+    (void)pthread_mutex_lock (&photo_lock);
+    if (pinned_photo != s || NULL == (p = s->photo)) {
+	p = load_photo (s);
+	pinned_photo = s;
+    }
+    (void)pthread_mutex_unlock (&photo_lock);
+    if (NULL == p) {
+	PANIC ("can't read room photo");
+    }
+    return p;
 }
 
 
@@ -832,7 +1501,7 @@ room_photo (const room_t* r)
 uint32_t 
 room_photo_height (const room_t* r)
 {
-    return photo_height (r->view);
+    return r->view->hdr.height;
 }
 
 
@@ -847,15 +1516,115 @@ room_photo_height (const room_t* r)
 uint32_t 
 room_photo_width (const room_t* r)
 {
-    return photo_width (r->view);
+    return r->view->hdr.width;
+}
+
+
+/* 
+ * world_set_load_threads
+ *   DESCRIPTION: Set the number of threads used by build_world to read
+ *                image data.
+ *   INPUTS: n -- number of threads; 0 for one per online processor, 1 to
+ *                read all files serially
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+world_set_load_threads (int32_t n)
+{
+    load_threads = n;
+}
+
+
+/* 
+ * world_set_photo_budget
+ *   DESCRIPTION: Set the number of bytes of room photo data kept in 
+ *                memory, taking effect the next time that the world is
+ *                built.
+ *   INPUTS: bytes -- the budget; 0 reads all photos when the world is 
+ *                    built and keeps them
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+world_set_photo_budget (uint32_t bytes)
+{
+    photo_budget = bytes;
+}
+
+
+/* 
+ * world_prefetch_neighbors
+ *   DESCRIPTION: Start reading, in the background, the photos of the rooms
+ *                that the player can reach from a room, along with any 
+ *                photos that may be swapped in for them.  Photos queued 
+ *                by any earlier call that have not yet been read are 
+ *                dropped.  Does nothing if all photos are kept in memory
+ *                (no photo budget) or the prefetch thread can't be 
+ *                started.
+ *   INPUTS: r -- the room that the player has just entered
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may start the prefetch thread
+ */
+void
+world_prefetch_neighbors (const room_t* r)
+{
+    room_t*   next[3];	/* rooms reached by moving or entering */
+    pthread_t tid;	/* prefetch thread id                  */
+    int32_t   i;	/* index over rooms and exits          */
+
+    if (0 == photo_budget) {
+        return;
+    }
+    (void)pthread_mutex_lock (&photo_lock);
+    if (!prefetch_started) {
+        if (0 != pthread_create (&tid, NULL, prefetch_worker, NULL)) {
+	    (void)pthread_mutex_unlock (&photo_lock);
+	    return;
+	}
+	(void)pthread_detach (tid);
+	prefetch_started = 1;
+    }
+
+    /* Queue the most likely destinations first. */
+    prefetch_count = 0;
+    next[0] = r->enter;
+    next[1] = r->left;
+    next[2] = r->right;
+    for (i = 0; 3 > i; i++) {
+        if (NULL != next[i]) {
+	    add_prefetch (next[i]->view);
+	    if (&room[R_CIRCLE_N] == next[i]) {
+	        add_prefetch (swap_photo[SWAP_CIRCLE]);
+	    }
+	}
+    }
+    for (i = 0; sizeof (extra_exits) / sizeof (extra_exits[0]) > i; i++) {
+        if (&room[extra_exits[i].from] == r) {
+	    add_prefetch (room[extra_exits[i].to].view);
+	}
+    }
+    if (&room[R_CAR_SITE] == r) {
+        add_prefetch (swap_photo[SWAP_CAR]);
+    }
+    add_prefetch (room[R_INVENTORY].view);
+    (void)pthread_cond_signal (&prefetch_wake);
+    (void)pthread_mutex_unlock (&photo_lock);
 }
 
 
 /* 
  * build_world
  *   DESCRIPTION: Builds and connects the rooms, creates objects, and 
- *                reads in all image data (could be done lazily with 
- *                caching instead).
+ *                reads in the object images and, unless a photo budget
+ *                is set (see world_set_photo_budget), all room photos;
+ *                otherwise, only the sizes of the photos are read.  
+ *                Image files are read in parallel first; errors are 
+ *                then reported in data array order, as if the files had
+ *                been read one by one.
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: 1 on success, or 0 on failure
@@ -864,9 +1633,36 @@ room_photo_width (const room_t* r)
 int32_t
 build_world ()
 {
+    static load_pool_t pool;	/* images read by worker threads */
     int32_t idx;	/* index over data arrays   */
     int32_t which;	/* id for current data item */
 
+    /* Every object must fit in the object index of a room. */
+    if (MAX_ROOM_OBJECTS < N_OBJECTS) {
+        fputs ("Too many objects for room object index.\n", stderr);
+	return 0;
+    }
+
+    /* 
+     * Release any photos from a previous world, first dropping any 
+     * prefetches and waiting for any photo being read to arrive.
+     */
+    (void)pthread_mutex_lock (&photo_lock);
+    prefetch_count = 0;
+    for (idx = 0; N_ROOMS + N_SWAPS > idx; idx++) {
+        while (photo_slot[idx].loading) {
+	    (void)pthread_cond_wait (&photo_ready, &photo_lock);
+	}
+    }
+    while (NULL != oldest_photo) {
+        release_photo (oldest_photo);
+    }
+    pinned_photo = NULL;
+    (void)pthread_mutex_unlock (&photo_lock);
+
+    /* Read all of the image data. */
+    load_all_images (&pool);
+
     /* Clear all accomplishment flags. */
     (void)memset (player_flags, 0, sizeof (player_flags));
 
@@ -891,13 +1687,15 @@ build_world ()
 
 	/* Set up the room. */
         room[which].name = room_data[idx].name;
-	room[which].view = read_photo (room_data[idx].filename);
-	if (NULL == room[which].view) {
+	room[which].view = &photo_slot[idx];
+	if (!set_up_slot (room[which].view, room_data[idx].filename, 
+			  pool.result[idx])) {
 	    fprintf (stderr, "Can't read room photo %s.\n", 
 	    	     room_data[idx].filename);
 	    return 0;
 	}
 	room[which].contents = NULL;
+	room[which].n_objs = 0;
 	room[which].left  = (R_NONE == room_data[idx].left ? NULL : 
 			     &room[room_data[idx].left]);
 	room[which].enter = (R_NONE == room_data[idx].enter ? NULL : 
@@ -927,7 +1725,7 @@ build_world ()
 
 	/* Set up the object. */
         object[which].name = obj_data[idx].name;
-	object[which].img = read_obj_image (obj_data[idx].filename);
+	object[which].img = pool.result[JOB_OBJECT_BASE + idx];
 	if (NULL == object[which].img) {
 	    fprintf (stderr, "Can't read object photo %s.\n", 
 	    	     obj_data[idx].filename);
@@ -968,9 +1766,10 @@ build_world ()
 	    return 0;
 	}
 
-	/* Read in the swap photo. */
-	swap_photo[which] = read_photo (swap_data[idx].filename);
-	if (NULL == swap_photo[which]) {
+	/* Set up the swap photo. */
+	swap_photo[which] = &photo_slot[N_ROOMS + idx];
+	if (!set_up_slot (swap_photo[which], swap_data[idx].filename, 
+			  pool.result[JOB_SWAP_BASE + idx])) {
 	    fprintf (stderr, "Can't read room photo %s.\n", 
 	    	     swap_data[idx].filename);
 	    return 0;
@@ -1913,3 +2712,416 @@ typed_cmd_wear (room_t** rptr, const char* arg)
     return TC_REDRAW_ROOM;
 }
 
+
+
+#if defined(WORLD_LOAD_BENCHMARK)
+
+#include <time.h>
+
+/*
+ * The code below replaces the game with a startup benchmark: it builds
+ * the world repeatedly with 1 to N image loading threads and reports the
+ * best time for each thread count along with the speedup relative to
+ * serial loading.  Each time includes getting the photo for the first
+ * room, as the game does before drawing its first frame.  Room photo 
+ * caches are disabled for these runs, so every photo is decoded.  The
+ * world is then built with photos read on demand, with the memory used by
+ * photos shown after the build and after visiting every room.  Next, 
+ * the benchmark takes the same random walk through the rooms twice, 
+ * pausing in each room as a player would, first without and then with 
+ * photo prefetching, and reports how long entering a room waits for its
+ * photo.  Then the world is built with all photos read from caches
+ * (written first if needed).  Last, it scrolls across every room in
+ * steps of 1 pixel and of the game's 2 and 6 pixels, drawing the
+ * exposed columns with the game's fill functions, once a line at a time
+ * and once as a strip, first timing only the fills and then the whole
+ * draw into the build buffer.  It then redraws the whole view at two
+ * corners of every room, a row at a time and in blocks of rows, timed 
+ * the same two ways.  The benchmark must be run from the directory 
+ * holding the images subdirectory.
+ */
+
+#define BENCH_REPS 3	/* builds timed for each thread count */
+#define BENCH_BUDGET (4 * 1024 * 1024) /* photo budget when on demand */
+#define WALK_STEPS 40	/* rooms entered in each walk         */
+#define WALK_PAUSE 50	/* time spent in each room in ms      */
+#define SCROLL_REPS 9	/* times each room is scrolled or redrawn */
+
+/* 
+ * show_status (interface function; declared in world.h)
+ *   DESCRIPTION: Stand-in for the game's status message routine, which
+ *                build_world may call; discards the message.
+ *   INPUTS: s -- the status message (ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+show_status (const char* s)
+{
+}
+
+
+/*
+ * time_build
+ *   DESCRIPTION: Build the world and get the first room's photo several 
+ *                times and find the best time.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: shortest build time in milliseconds, or a negative
+ *                 number if the world can't be built
+ *   SIDE EFFECTS: builds the world BENCH_REPS times
+ */
+static double
+time_build ()
+{
+    struct timespec start;  /* time at start of build_world */
+    struct timespec end;    /* time at end of build_world   */
+    int32_t rep;            /* loop index over repetitions  */
+    double  ms;             /* time for one build in ms     */
+    double  best = 0.0;     /* best time so far             */
+
+    for (rep = 0; BENCH_REPS > rep; rep++) {
+	(void)clock_gettime (CLOCK_MONOTONIC, &start);
+	if (!build_world ()) {
+	    fputs ("build_world failed\n", stderr);
+	    return -1.0;
+	}
+	(void)room_photo (start_in_room ());
+	(void)clock_gettime (CLOCK_MONOTONIC, &end);
+	ms = (end.tv_sec - start.tv_sec) * 1000.0 +
+	     (end.tv_nsec - start.tv_nsec) / 1000000.0;
+	if (0 == rep || best > ms) {
+	    best = ms;
+	}
+    }
+    return best;
+}
+
+
+/*
+ * time_walk
+ *   DESCRIPTION: Build the world, then take a random walk through it and
+ *                measure the time that room_photo takes on entering each
+ *                room.
+ *   INPUTS: prefetch -- non-zero to prefetch photos of neighboring rooms
+ *                       while pausing in each room
+ *   OUTPUTS: worst -- longest wait in milliseconds
+ *   RETURN VALUE: average wait in milliseconds, or a negative number if
+ *                 the world can't be built
+ *   SIDE EFFECTS: builds the world; sleeps
+ */
+static double
+time_walk (int32_t prefetch, double* worst)
+{
+    static const struct timespec pause = {0, WALK_PAUSE * 1000000L};
+    struct timespec start;  /* time before room_photo    */
+    struct timespec end;    /* time after room_photo     */
+    room_t* r;              /* current room              */
+    room_t* next[3];        /* rooms reachable from r    */
+    int32_t n_next;         /* number of reachable rooms */
+    int32_t step;           /* loop index over steps     */
+    double  ms;             /* wait for one room         */
+    double  total = 0.0;    /* total wait                */
+
+    if (!build_world ()) {
+	fputs ("build_world failed\n", stderr);
+	return -1.0;
+    }
+    srand (1);
+    r = start_in_room ();
+    (void)room_photo (r);
+    *worst = 0.0;
+    for (step = 0; WALK_STEPS > step; step++) {
+	if (prefetch) {
+	    world_prefetch_neighbors (r);
+	}
+	(void)nanosleep (&pause, NULL);
+	n_next = 0;
+	if (NULL != r->left) {
+	    next[n_next++] = r->left;
+	}
+	if (NULL != r->enter) {
+	    next[n_next++] = r->enter;
+	}
+	if (NULL != r->right) {
+	    next[n_next++] = r->right;
+	}
+	if (0 < n_next) {
+	    r = next[rand () % n_next];
+	}
+	(void)clock_gettime (CLOCK_MONOTONIC, &start);
+	(void)room_photo (r);
+	(void)clock_gettime (CLOCK_MONOTONIC, &end);
+	ms = (end.tv_sec - start.tv_sec) * 1000.0 +
+	     (end.tv_nsec - start.tv_nsec) / 1000000.0;
+	total += ms;
+	if (*worst < ms) {
+	    *worst = ms;
+	}
+    }
+    return total / WALK_STEPS;
+}
+
+
+/*
+ * time_scroll
+ *   DESCRIPTION: Scroll the view right across every room wider than the
+ *                screen, drawing the columns exposed at each step with
+ *                the game's fill functions, and measure the average time
+ *                per step.
+ *   INPUTS: width -- number of pixels moved per step
+ *           strip -- non-zero to get the columns as one strip, or zero
+ *                    to get them one at a time
+ *           draw -- non-zero to draw the columns into the build buffer
+ *                   (with draw_vert_strip or draw_vert_line), or zero
+ *                   only to fill them (with fill_vert_strip or 
+ *                   fill_vert_buffer)
+ *   OUTPUTS: none
+ *   RETURN VALUE: time per step in nanoseconds
+ *   SIDE EFFECTS: changes the current room and view window; draws into
+ *                 the build buffer
+ */
+static double
+time_scroll (int32_t width, int32_t strip, int32_t draw)
+{
+    static unsigned char buf[MAX_STRIP_WIDTH][SCROLL_Y_DIM]; /* fills */
+    struct timespec start;  /* time at start of pass       */
+    struct timespec end;    /* time at end of pass         */
+    int32_t n;              /* loop index over rooms       */
+    int32_t rep;            /* loop index over passes      */
+    int32_t x;              /* left edge of view           */
+    int32_t i;              /* loop index over columns     */
+    int32_t steps = 0;      /* scroll steps in one pass    */
+    double  ns;             /* time for one pass           */
+    double  best;           /* best time for room's passes */
+    double  total = 0.0;    /* sum of best times           */
+
+    for (n = 0; N_ROOMS > n; n++) {
+	/* Draw one line first, so that the photo is ready to scroll. */
+	prep_room (&room[n]);
+	set_view_window (0, 0);
+	(void)draw_vert_line (0);
+
+	for (rep = 0; SCROLL_REPS > rep; rep++) {
+	    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+	    for (x = width; room_photo_width (&room[n]) >= x + SCROLL_X_DIM;
+		 x += width) {
+		set_view_window (x, 0);
+		if (draw && strip) {
+		    (void)draw_vert_strip (SCROLL_X_DIM - width, width);
+		} else if (draw) {
+		    for (i = 1; width >= i; i++) {
+			(void)draw_vert_line (SCROLL_X_DIM - i);
+		    }
+		} else if (strip) {
+		    fill_vert_strip (x + SCROLL_X_DIM - width, 0, width, buf);
+		} else {
+		    for (i = 1; width >= i; i++) {
+			fill_vert_buffer (x + SCROLL_X_DIM - i, 0, buf[0]);
+		    }
+		}
+		if (0 == rep) {
+		    steps++;
+		}
+	    }
+	    (void)clock_gettime (CLOCK_MONOTONIC, &end);
+	    ns = (end.tv_sec - start.tv_sec) * 1e9 + 
+		 (end.tv_nsec - start.tv_nsec);
+	    if (0 == rep || best > ns) {
+		best = ns;
+	    }
+	}
+	total += best;
+    }
+    return total / (0 < steps ? steps : 1);
+}
+
+
+/*
+ * time_redraw
+ *   DESCRIPTION: Redraw the whole view in every room with the game's fill
+ *                functions, at the room's top left and bottom right 
+ *                corners, and measure the average time per view.
+ *   INPUTS: block -- non-zero to get the rows MAX_BLOCK_HEIGHT at a time,
+ *                    or zero to get them one at a time
+ *           draw -- non-zero to draw the rows into the build buffer
+ *                   (with draw_horiz_block or draw_horiz_line), or zero
+ *                   only to fill them (with fill_horiz_block or 
+ *                   fill_horiz_buffer)
+ *   OUTPUTS: none
+ *   RETURN VALUE: time per view in microseconds
+ *   SIDE EFFECTS: changes the current room and view window; draws into
+ *                 the build buffer
+ */
+static double
+time_redraw (int32_t block, int32_t draw)
+{
+    static unsigned char buf[MAX_BLOCK_HEIGHT][SCROLL_X_DIM]; /* fills */
+    struct timespec start;  /* time at start of redraw     */
+    struct timespec end;    /* time at end of redraw       */
+    int32_t n;              /* loop index over rooms       */
+    int32_t corner;         /* loop index over corners     */
+    int32_t rep;            /* loop index over redraws     */
+    int32_t x;              /* left edge of view           */
+    int32_t y;              /* top edge of view            */
+    int32_t i;              /* loop index over rows        */
+    int32_t h;              /* rows in block               */
+    int32_t views = 0;      /* views redrawn               */
+    double  ns;             /* time for one redraw         */
+    double  best;           /* best time for view          */
+    double  total = 0.0;    /* sum of best times           */
+
+    for (n = 0; N_ROOMS > n; n++) {
+	prep_room (&room[n]);
+	for (corner = 0; 2 > corner; corner++, views++) {
+	    x = (corner ? room_photo_width (&room[n]) - SCROLL_X_DIM : 0);
+	    y = (corner ? room_photo_height (&room[n]) - SCROLL_Y_DIM : 0);
+	    set_view_window (x, y);
+	    for (rep = 0; SCROLL_REPS > rep; rep++) {
+		(void)clock_gettime (CLOCK_MONOTONIC, &start);
+		if (draw && block) {
+		    (void)draw_horiz_block (0, SCROLL_Y_DIM);
+		} else if (draw) {
+		    for (i = 0; SCROLL_Y_DIM > i; i++) {
+			(void)draw_horiz_line (i);
+		    }
+		} else if (block) {
+		    for (i = 0; SCROLL_Y_DIM > i; i += h) {
+			h = (SCROLL_Y_DIM - i < MAX_BLOCK_HEIGHT ?
+			     SCROLL_Y_DIM - i : MAX_BLOCK_HEIGHT);
+			fill_horiz_block (x, y + i, h, buf);
+		    }
+		} else {
+		    for (i = 0; SCROLL_Y_DIM > i; i++) {
+			fill_horiz_buffer (x, y + i, buf[0]);
+		    }
+		}
+		(void)clock_gettime (CLOCK_MONOTONIC, &end);
+		ns = (end.tv_sec - start.tv_sec) * 1e9 + 
+		     (end.tv_nsec - start.tv_nsec);
+		if (0 == rep || best > ns) {
+		    best = ns;
+		}
+	    }
+	    total += best;
+	}
+    }
+    return total / 1000.0 / (0 < views ? views : 1);
+}
+
+
+/*
+ * main -- for the "worldbench" program
+ *   DESCRIPTION: Time build_world with increasing numbers of threads,
+ *                then with photos read on demand, then walking through
+ *                the world with and without prefetching, then with room
+ *                photo caches, then time scrolling through the rooms 
+ *                and redrawing their views.
+ *   INPUTS: argv[1] -- (optional) maximum number of threads; defaults to
+ *                      twice the number of online processors
+ *   OUTPUTS: prints one line of timing results per thread count, one for
+ *            reading on demand, one for each walk, one for the caches,
+ *            two for each scroll step, and two for redrawing the view
+ *   RETURN VALUE: 0 on success, 3 if the world can't be built
+ */
+int
+main (int argc, char* argv[])
+{
+    int32_t max_threads;    /* largest thread count to try  */
+    int32_t n;              /* loop index over thread count */
+    double  best;           /* best time for thread count   */
+    double  serial = 0.0;   /* best time with one thread    */
+    size_t  all_bytes;      /* photo data with all photos   */
+    size_t  first_bytes;    /* photo data after first room  */
+    double  worst;          /* longest wait during walk     */
+    double  strip;          /* scroll step drawn as a strip */
+    static const int32_t widths[] = {1, 2, 6}; /* scroll steps timed */
+
+    max_threads = (1 < argc ? atoi (argv[1]) :
+    		   2 * sysconf (_SC_NPROCESSORS_ONLN));
+    if (1 > max_threads) {
+        max_threads = 1;
+    }
+
+    photo_set_cache (0);
+    world_set_photo_budget (0);
+    for (n = 1; max_threads >= n; n++) {
+	world_set_load_threads (n);
+	if (0.0 > (best = time_build ())) {
+	    return 3;
+	}
+	if (1 == n) {
+	    serial = best;
+	}
+	printf ("%2d thread%s %9.1f ms  speedup %5.2fx\n", n, 
+		(1 == n ? ": " : "s:"), best, serial / best);
+    }
+
+    all_bytes = photo_bytes;
+
+    /* Read photos on demand, then visit every room. */
+    world_set_photo_budget (BENCH_BUDGET);
+    world_set_load_threads (0);
+    if (0.0 > (best = time_build ())) {
+        return 3;
+    }
+    first_bytes = photo_bytes;
+    for (n = 0; N_ROOMS > n; n++) {
+        (void)room_photo (&room[n]);
+    }
+    printf ("on demand: %9.1f ms  speedup %5.2fx  photo data %zu KB "
+	    "(all rooms visited: %zu KB; all read: %zu KB)\n", best, 
+	    serial / best, first_bytes / 1024, photo_bytes / 1024, 
+	    all_bytes / 1024);
+
+    /* Walk through the world without and with prefetching. */
+    for (n = 0; 2 > n; n++) {
+        if (0.0 > (best = time_walk (n, &worst))) {
+	    return 3;
+	}
+	printf ("walk %-12s room entry waits %7.3f ms on average, "
+		"%7.3f ms at worst\n", (n ? "(prefetch):" : "(on demand):"),
+		best, worst);
+    }
+
+    /* Write any missing caches before timing builds from them. */
+    world_set_photo_budget (0);
+    photo_set_cache (1);
+    if (!build_world () || 0.0 > (best = time_build ())) {
+        return 3;
+    }
+    printf ("   cached: %9.1f ms  speedup %5.2fx\n", best, serial / best);
+
+    /* Draw the columns exposed by scrolling through each room. */
+    set_display_backend (DISPLAY_HEADLESS);
+    if (0 != set_mode_X (fill_horiz_buffer, fill_vert_buffer, 
+			 fill_vert_strip, fill_horiz_block)) {
+        return 3;
+    }
+    for (n = 0; sizeof (widths) / sizeof (widths[0]) > n; n++) {
+	best = time_scroll (widths[n], 0, 0);
+	strip = time_scroll (widths[n], 1, 0);
+	printf ("scroll %d columns: fill lines %6.1f ns  strip %6.1f ns  "
+		"speedup %5.2fx\n", widths[n], best, strip, best / strip);
+	best = time_scroll (widths[n], 0, 1);
+	strip = time_scroll (widths[n], 1, 1);
+	printf ("scroll %d columns: draw lines %6.1f ns  strip %6.1f ns  "
+		"speedup %5.2fx\n", widths[n], best, strip, best / strip);
+    }
+
+    /* Redraw the whole view in each room. */
+    best = time_redraw (0, 0);
+    strip = time_redraw (1, 0);
+    printf ("redraw view: fill lines %6.1f us  block %6.1f us  "
+	    "speedup %5.2fx\n", best, strip, best / strip);
+    best = time_redraw (0, 1);
+    strip = time_redraw (1, 1);
+    printf ("redraw view: draw lines %6.1f us  block %6.1f us  "
+	    "speedup %5.2fx\n", best, strip, best / strip);
+    clear_mode_X ();
+
+    return 0;
+}
+
+#endif /* defined(WORLD_LOAD_BENCHMARK) */
@@ -39,6 +39,9 @@
 #include "types.h"
 
 
+/* largest number of objects that can be in one room */
+#define MAX_ROOM_OBJECTS 32
+
 /* structure access functions */
 extern uint16_t obj_get_x (const object_t* obj);
 extern uint16_t obj_get_y (const object_t* obj);
@@ -46,10 +49,35 @@ extern image_t* obj_image (const object_t* obj);
 extern object_t* obj_next (const object_t* obj);
 extern object_t* room_contents_iterate (const room_t* r);
 extern const char* room_name (const room_t* r);
+extern int32_t room_objects_in_cols (const room_t* r, int32_t x, 
+				     int32_t width,
+				     object_t* objs[MAX_ROOM_OBJECTS]);
+extern int32_t room_objects_in_rows (const room_t* r, int32_t y, 
+				     int32_t height,
+				     object_t* objs[MAX_ROOM_OBJECTS]);
+extern int32_t room_objects_on_col (const room_t* r, int32_t x,
+				    object_t* objs[MAX_ROOM_OBJECTS]);
+extern int32_t room_objects_on_row (const room_t* r, int32_t y,
+				    object_t* objs[MAX_ROOM_OBJECTS]);
 extern photo_t* room_photo (const room_t* r);
 extern uint32_t room_photo_height (const room_t* r);
 extern uint32_t room_photo_width (const room_t* r);
 
+/* 
+ * Set the number of threads used to read image data when building the 
+ * world (0 for one per processor, 1 for serial reading).
+ */
+extern void world_set_load_threads (int32_t n);
+
+/* 
+ * Set the number of bytes of room photo data kept in memory (0 to read
+ * all photos when building the world and keep them).
+ */
+extern void world_set_photo_budget (uint32_t bytes);
+
+/* Read photos of the rooms reachable from a room in the background. */
+extern void world_prefetch_neighbors (const room_t* r);
+
 /* Build the game world.  Returns 0 on failure, or 1 on success. */
 extern int32_t build_world (void);
 